@@ -0,0 +1,51 @@
+TEMPLATE = app
+CONFIG += console c++2a
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ../DibTest
+
+SOURCES += \
+        ../DibTest/backend.cpp \
+        ../DibTest/dib.cpp \
+        ../DibTest/draw.cpp \
+        ../DibTest/hash.cpp \
+        ../DibTest/image.cpp \
+        ../DibTest/parallel.cpp \
+        ../DibTest/png.cpp \
+        ../DibTest/premultiply.cpp \
+        ../DibTest/rowsource.cpp \
+        ../DibTest/scale.cpp \
+        ../DibTest/trace.cpp \
+        main.cpp
+
+HEADERS += \
+        ../DibTest/backend.h \
+        ../DibTest/bytewriter.h \
+        ../DibTest/dib.h \
+        ../DibTest/dibstructs.h \
+        ../DibTest/draw.h \
+        ../DibTest/hash.h \
+        ../DibTest/image.h \
+        ../DibTest/parallel.h \
+        ../DibTest/pixelformat.h \
+        ../DibTest/png.h \
+        ../DibTest/premultiply.h \
+        ../DibTest/rowsource.h \
+        ../DibTest/scale.h \
+        ../DibTest/trace.h
+
+# Hot path tracing, see trace.h
+# DEFINES += CLIPBOARD_TRACE
+
+# System clipboard; elsewhere only LoopbackBackend is there
+win32 {
+    SOURCES += ../DibTest/clipboard.cpp
+    HEADERS += ../DibTest/clipboard.h
+    LIBS += -lgdi32 -lpsapi
+}
+
+win32-g++ {
+    QMAKE_CXXFLAGS += -static-libgcc -static-libstdc++
+    LIBS += -static -lpthread
+}
@@ -0,0 +1,237 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#include "backend.h"
+#include "trace.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+
+    #include "clipboard.h"
+#else
+    #include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+using Ms = std::chrono::duration<double, std::milli>;
+
+struct Size {
+    const char* name;
+    size_t width, height;
+};
+
+constexpr Size SIZES[] {
+    { "icon",    32,    32 },
+    { "thumb",  256,   256 },
+    { "HD",    1920,  1080 },
+    { "4K",    3840,  2160 },
+    { "8K",    7680,  4320 },
+    { "16K",  16384, 16384 },
+};
+
+constexpr Format FORMATS[] {
+    Format::DIB_OLD, Format::DIB_NEW_SHORT, Format::DIB_NEW_LONG, Format::BITMAP,
+    Format::PNG };
+
+const char* formatName(Format fmt)
+{
+    switch (fmt) {
+    case Format::DIB_OLD: return "DIB_OLD";
+    case Format::DIB_NEW_SHORT: return "DIB_NEW_SHORT";
+    case Format::DIB_NEW_LONG: return "DIB_NEW_LONG";
+    case Format::PNG: return "PNG";
+    case Format::BITMAP: break;
+    }
+    return "BITMAP";
+}
+
+/// Current working set (resident set); peak would be the process’s own
+/// high-water mark, not this case’s
+size_t workingSet()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    memset(&pmc, 0, sizeof(pmc));
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.WorkingSetSize;
+#else
+    // Pages: total, then resident
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (!(statm >> total >> resident))
+        return 0;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+///
+///  Polls working set on its own thread while alive: buffers a case frees
+///  before it returns are gone by the time the case could look
+///
+class WorkingSetSampler
+{
+public:
+    WorkingSetSampler() : fBefore(workingSet()), fMax(fBefore),
+        fThread([this] {
+            while (!fQuit) {
+                auto ws = workingSet();
+                if (ws > fMax)
+                    fMax = ws;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }) {}
+    ~WorkingSetSampler() { stop(); }
+
+    /// Highest working set seen over what it was at start
+    size_t growth()
+    {
+        stop();
+        return std::max(fMax.load(), workingSet()) - fBefore;
+    }
+private:
+    size_t fBefore;
+    std::atomic<size_t> fMax;
+    std::atomic<bool> fQuit = false;
+    std::thread fThread;
+
+    void stop()
+    {
+        fQuit = true;
+        if (fThread.joinable())
+            fThread.join();
+    }
+};
+
+/// Runs body several times, at least 3 and until about a second passes,
+/// and reports throughput over nBytes with median and 99th percentile,
+/// and how much working set grew over what it was before the case
+template <class Body>
+void bench(const char* caseName, const Size& size, size_t nBytes, Body&& body)
+{
+    constexpr int MIN_RUNS = 3, MAX_RUNS = 1000;
+    constexpr Ms BUDGET { 1000 };
+
+    std::vector<double> times;
+    Ms total { 0 };
+    WorkingSetSampler ws;
+    while (times.size() < MIN_RUNS
+           || (times.size() < MAX_RUNS && total < BUDGET)) {
+        auto start = Clock::now();
+        body();
+        Ms time = Clock::now() - start;
+        times.push_back(time.count());
+        total += time;
+    }
+    std::sort(times.begin(), times.end());
+    auto p50 = times[times.size() / 2];
+    auto p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+    double mbPerSec = (p50 > 0) ? (nBytes / 1e6) / (p50 / 1e3) : 0;
+
+    std::cout << std::left << std::setw(6) << size.name
+              << std::setw(28) << caseName << std::right << std::fixed
+              << std::setw(10) << std::setprecision(1) << mbPerSec << " MB/s"
+              << std::setw(11) << std::setprecision(3) << p50 << " ms"
+              << std::setw(11) << p99 << " ms"
+              << std::setw(9) << ws.growth() / (1024 * 1024) << " MB"
+              << std::endl;
+}
+
+void benchSize(const Size& size)
+{
+    Image im(size.width, size.height, SEMI_AQUA);
+    auto nBytes = im.nBytes();
+
+    std::vector<char> buf(nBytes);
+    bench("writeImageData", size, nBytes, [&] {
+        writeImageData(buf.data(), im);
+    });
+    buf = {};
+
+    bench("makeOldDib", size, nBytes, [&] {
+        auto dib = makeOldDib(im);
+    });
+    bench("makeNewDib(SHORT)", size, nBytes, [&] {
+        auto dib = makeNewDib(im, LongDib::NO);
+    });
+    bench("makeNewDib(LONG)", size, nBytes, [&] {
+        auto dib = makeNewDib(im, LongDib::YES);
+    });
+
+    // Encoding pipeline with no system clipboard, runs anywhere
+    LoopbackBackend loopback;
+    auto shared = std::make_shared<const Image>(im);
+    for (auto fmt : FORMATS) {
+        std::string caseName = std::string("loopback(") + formatName(fmt) + ")";
+        bench(caseName.c_str(), size, nBytes, [&] {
+            loopback.copyImage(shared, std::span(&fmt, 1));
+            auto data = loopback.data(fmt);
+        });
+    }
+    shared = {};
+
+#ifdef _WIN32
+    for (auto fmt : FORMATS) {
+        std::string caseName = std::string("copyImage(") + formatName(fmt) + ")";
+        bench(caseName.c_str(), size, nBytes, [&] {
+            Clipboard clip;
+            clip.copyImage(im, fmt);
+        });
+    }
+    DibCache cache;
+    bench("copyImageCached(LONG)", size, nBytes, [&] {
+        copyImageCached(cache, im, Format::DIB_NEW_LONG);
+    });
+    bench("copyImageWithPreviews(4)", size, nBytes, [&] {
+        Clipboard clip;
+        clip.copyImageWithPreviews(im, Format::DIB_NEW_SHORT, 4);
+    });
+#endif
+}
+
+///
+///  Usage: DibBench [maxSizes]
+///  maxSizes limits the sizes run, from icon up to 16K×16K
+///  Built with CLIPBOARD_TRACE, also writes DibBench.trace.json
+///
+int main(int argc, char* argv[])
+{
+    size_t nSizes = std::size(SIZES);
+    if (argc > 1)
+        nSizes = std::clamp<size_t>(std::atoi(argv[1]), 1, nSizes);
+#ifdef CLIPBOARD_TRACE
+    ChromeTraceSink traceSink;
+    setTraceSink(&traceSink);
+#endif
+    try {
+        std::cout << std::left << std::setw(6) << "Size" << std::setw(28) << "Case"
+                  << std::right << std::setw(15) << "Throughput"
+                  << std::setw(14) << "p50" << std::setw(14) << "p99"
+                  << std::setw(12) << "WS growth" << '\n';
+        for (size_t i = 0; i < nSizes; ++i)
+            benchSize(SIZES[i]);
+#ifdef _WIN32
+        auto stats = clipboardStats();
+        std::cout << "Clipboard: " << stats.nOpens << " opens, "
+                  << stats.nAttempts << " attempts, "
+                  << stats.nFailures << " failures, waited "
+                  << stats.waitTime.count() / 1000.0 << " ms\n";
+#endif
+#ifdef CLIPBOARD_TRACE
+        setTraceSink(nullptr);
+        std::ofstream os("DibBench.trace.json");
+        traceSink.writeJson(os);
+#endif
+    } catch (const std::exception& e) {
+        std::cout << "ERROR: " << e.what() << '\n';
+        return 1;
+    }
+}
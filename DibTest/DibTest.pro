@@ -4,7 +4,39 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 SOURCES += \
-        main.cpp
+        backend.cpp \
+        clipboard.cpp \
+        dib.cpp \
+        draw.cpp \
+        hash.cpp \
+        image.cpp \
+        parallel.cpp \
+        main.cpp \
+        png.cpp \
+        premultiply.cpp \
+        rowsource.cpp \
+        scale.cpp \
+        trace.cpp
+
+HEADERS += \
+        backend.h \
+        bytewriter.h \
+        clipboard.h \
+        dib.h \
+        dibstructs.h \
+        draw.h \
+        hash.h \
+        image.h \
+        parallel.h \
+        pixelformat.h \
+        png.h \
+        premultiply.h \
+        rowsource.h \
+        scale.h \
+        trace.h
+
+# Hot path tracing, see trace.h
+# DEFINES += CLIPBOARD_TRACE
 
 LIBS += -lgdi32
 
@@ -0,0 +1,87 @@
+#include "backend.h"
+
+#include <algorithm>
+
+#include "png.h"
+#include "trace.h"
+
+
+void LoopbackBackend::copyImage(std::shared_ptr<const Image> im, std::span<const Format> fmts,
+                                Orient orient)
+{
+    std::lock_guard lock(fMutex);
+    fImage = std::move(im);
+    fOrient = orient;
+    fFormats.assign(fmts.begin(), fmts.end());
+    fRendered.clear();
+    ++fSequence;
+}
+
+
+std::shared_ptr<const Image> LoopbackBackend::pasteImage()
+{
+    std::lock_guard lock(fMutex);
+    return fImage;
+}
+
+
+uint64_t LoopbackBackend::sequence() const
+{
+    std::lock_guard lock(fMutex);
+    return fSequence;
+}
+
+
+std::vector<Format> LoopbackBackend::formats() const
+{
+    std::lock_guard lock(fMutex);
+    return fFormats;
+}
+
+
+std::shared_ptr<const ByteBuffer> LoopbackBackend::data(Format fmt)
+{
+    std::shared_ptr<const Image> im;
+    Orient orient;
+    uint64_t sequence;
+    {
+        std::lock_guard lock(fMutex);
+        if (std::find(fFormats.begin(), fFormats.end(), fmt) == fFormats.end())
+            return nullptr;
+        if (auto it = fRendered.find(fmt); it != fRendered.end())
+            return it->second;
+        im = fImage;
+        orient = fOrient;
+        sequence = fSequence;
+    }
+
+    // Encoded with no lock held, image is kept alive by im
+    TRACE_SCOPE("LoopbackBackend::render");
+    auto r = std::make_shared<ByteBuffer>();
+    if (isDib(fmt)) {
+        auto w = r->writer(dibSize(*im, fmt));
+        writeDib(w, *im, fmt, orient);
+    } else if (fmt == Format::PNG) {
+        auto png = encodePng(*im);
+        r->writer(png.size()).write(png.data(), png.size());
+    } else {
+        auto w = r->writer(im->nBytes());
+        writeImageData(w, *im, Orient::TOP_DOWN, Alpha::PREMULTIPLIED);
+    }
+
+    std::lock_guard lock(fMutex);
+    // Someone copied meanwhile: r is still what was asked for, just not kept
+    if (fSequence == sequence)
+        fRendered.emplace(fmt, r);
+    return r;
+}
+
+
+void LoopbackBackend::clear()
+{
+    std::lock_guard lock(fMutex);
+    fImage.reset();
+    fFormats.clear();
+    fRendered.clear();
+    ++fSequence;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "dib.h"
+
+///
+///  Clipboard as the pipeline sees it: publishes images in some formats
+///  and reads them back. Win32Backend (clipboard.h) is the system
+///  clipboard; LoopbackBackend keeps everything in process and builds
+///  everywhere.
+///
+class ClipboardBackend
+{
+public:
+    virtual ~ClipboardBackend() = default;
+
+    /// Replaces contents with im, promised in fmts
+    virtual void copyImage(std::shared_ptr<const Image> im, std::span<const Format> fmts,
+                           Orient orient = Orient::BOTTOM_UP) = 0;
+    /// Same, takes over pixels of im without copying them
+    void copyImage(Image&& im, std::span<const Format> fmts,
+                   Orient orient = Orient::BOTTOM_UP)
+        { copyImage(std::make_shared<const Image>(std::move(im)), fmts, orient); }
+    /// Image on clipboard; nullptr if there is none
+    virtual std::shared_ptr<const Image> pasteImage() = 0;
+    /// Changes whenever contents change
+    virtual uint64_t sequence() const = 0;
+};
+
+///
+///  In-process clipboard: paste gets the very Image that copy gave, with
+///  no encoding and no copies. Bytes of a format are encoded only when
+///  someone asks for them, as delayed rendering does, and are kept until
+///  the next copy. Thread-safe.
+///
+class LoopbackBackend : public ClipboardBackend
+{
+public:
+    using ClipboardBackend::copyImage;
+    void copyImage(std::shared_ptr<const Image> im, std::span<const Format> fmts,
+                   Orient orient = Orient::BOTTOM_UP) override;
+    std::shared_ptr<const Image> pasteImage() override;
+    uint64_t sequence() const override;
+
+    /// Formats promised by the last copy
+    std::vector<Format> formats() const;
+    /// Bytes of fmt as system clipboard would have them; for BITMAP,
+    /// premultiplied top-down pixels CreateBitmap gets.
+    /// @return  nullptr if fmt was not promised
+    std::shared_ptr<const ByteBuffer> data(Format fmt);
+    /// Empties clipboard
+    void clear();
+private:
+    mutable std::mutex fMutex;
+    std::shared_ptr<const Image> fImage;
+    Orient fOrient = Orient::BOTTOM_UP;
+    std::vector<Format> fFormats;
+    std::map<Format, std::shared_ptr<const ByteBuffer>> fRendered;
+    uint64_t fSequence = 0;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "image.h"
+
+///
+///  Cursor over pre-reserved bytes: writers append with plain stores,
+///  no virtual calls and no reallocation. Backend (vector, global memory,
+///  file mapping) only provides the bytes. Writing past the end throws;
+///  backends check that writers filled everything.
+///
+class ByteWriter
+{
+public:
+    ByteWriter(char* p, size_t nBytes) : fBegin(p), fCur(p), fEnd(p + nBytes) {}
+    explicit ByteWriter(std::span<char> dest) : ByteWriter(dest.data(), dest.size()) {}
+
+    size_t written() const { return fCur - fBegin; }
+    size_t remaining() const { return fEnd - fCur; }
+    bool isFull() const { return fCur == fEnd; }
+
+    /// Gives n bytes to caller to fill in place, e.g. pixels
+    char* take(size_t n)
+    {
+        if (n > remaining()) [[unlikely]]
+            throwOverflow();
+        return std::exchange(fCur, fCur + n);
+    }
+    void write(const void* data, size_t n)
+        { memcpy(take(n), data, n); }
+    template <class T> requires std::is_trivially_copyable_v<T>
+        void write(const T& x) { write(&x, sizeof(x)); }
+    /// Throws unless everything is written
+    void checkFull() const
+        { if (!isFull()) [[unlikely]] throwUnderflow(); }
+private:
+    char* fBegin;
+    char* fCur;
+    char* fEnd;
+
+    [[noreturn]] static void throwOverflow()
+        { throw std::logic_error("Writing past reserved bytes"); }
+    [[noreturn]] static void throwUnderflow()
+        { throw std::logic_error("Reserved bytes are not written"); }
+};
+
+///
+///  Vector backend: keeps its capacity between uses
+///
+class ByteBuffer
+{
+public:
+    /// Resizes to exactly nBytes, old contents are garbage
+    ByteWriter writer(size_t nBytes)
+    {
+        fData.resize(nBytes);
+        return ByteWriter(fData.data(), nBytes);
+    }
+    std::span<const char> bytes() const { return { fData.data(), fData.size() }; }
+    std::span<char> bytes() { return { fData.data(), fData.size() }; }
+    size_t size() const { return fData.size(); }
+    void clear() { fData = {}; }
+private:
+    std::vector<char, NoInitAllocator<char>> fData;
+};
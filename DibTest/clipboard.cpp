@@ -0,0 +1,1411 @@
+#include "clipboard.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <shlobj.h>
+
+#include "hash.h"
+#include "parallel.h"
+#include "png.h"
+#include "premultiply.h"
+#include "scale.h"
+#include "trace.h"
+
+
+uint32_t nativeFormat(Format fmt)
+{
+    switch (fmt) {
+    case Format::DIB_OLD:
+        return CF_DIB;
+    case Format::DIB_NEW_SHORT:
+    case Format::DIB_NEW_LONG:
+        return CF_DIBV5;
+    case Format::PNG: {
+            static const uint32_t png = RegisterClipboardFormatW(L"PNG");
+            return png;
+        }
+    case Format::BITMAP:
+        break;
+    }
+    return CF_BITMAP;
+}
+
+namespace {
+
+    ///
+    ///  Global memory locked while being written; freed unless released
+    ///
+    class LockedGlobal
+    {
+    public:
+        explicit LockedGlobal(size_t nBytes);
+        ~LockedGlobal();
+        LockedGlobal(LockedGlobal&& x) noexcept
+            : fHandle(std::exchange(x.fHandle, nullptr)),
+              fData(std::exchange(x.fData, nullptr)) {}
+        LockedGlobal& operator = (LockedGlobal&&) = delete;
+
+        char* data() const { return fData; }
+        /// Unlocks memory and gives it to caller
+        HGLOBAL release();
+    private:
+        HGLOBAL fHandle = nullptr;
+        char* fData = nullptr;
+    };
+
+    LockedGlobal::LockedGlobal(size_t nBytes)
+    {
+        {
+            TRACE_SCOPE("GlobalAlloc");
+            fHandle = GlobalAlloc(GMEM_MOVEABLE, nBytes);
+        }
+        if (!fHandle)
+            throw std::logic_error("Cannot allocate data");
+        fData = static_cast<char*>(GlobalLock(fHandle));
+        if (!fData) {
+            GlobalFree(fHandle);
+            throw std::logic_error("Cannot lock data");
+        }
+    }
+
+    LockedGlobal::~LockedGlobal()
+    {
+        if (fHandle) {
+            GlobalUnlock(fHandle);
+            GlobalFree(fHandle);
+        }
+    }
+
+    HGLOBAL LockedGlobal::release()
+    {
+        GlobalUnlock(fHandle);
+        fData = nullptr;
+        return std::exchange(fHandle, nullptr);
+    }
+
+}   // anon namespace
+
+HGLOBAL allocGlobal(size_t nBytes, const std::function<void(ByteWriter&)>& writer)
+{
+    TRACE_COUNT("allocGlobal.bytes", nBytes);
+    LockedGlobal mem(nBytes);
+    ByteWriter w(mem.data(), nBytes);
+    writer(w);
+    w.checkFull();
+    return mem.release();
+}
+
+HGLOBAL allocGlobal(size_t nBytes, const std::function<void(char*)>& writer)
+{
+    return allocGlobal(nBytes, [nBytes, &writer](ByteWriter& w) { writer(w.take(nBytes)); });
+}
+
+void setGlobalData(uint32_t nativeFormat, HGLOBAL data)
+{
+    TRACE_SCOPE("SetClipboardData");
+    if (!SetClipboardData(nativeFormat, data)) {
+        // Until SetClipboardData succeeds, the memory is still ours
+        GlobalFree(data);
+        throw std::logic_error("Cannot set clipboard data");
+    }
+}
+
+void setBitmapData(HBITMAP bm)
+{
+    if (!bm)
+        throw std::logic_error("Cannot create bitmap");
+    TRACE_SCOPE("SetClipboardData");
+    if (!SetClipboardData(CF_BITMAP, bm)) {
+        DeleteObject(bm);
+        throw std::logic_error("Cannot set clipboard data");
+    }
+}
+
+ClipData::ClipData(uint32_t nativeFormat, HANDLE handle)
+    : fFormat(nativeFormat), fHandle(handle) {}
+
+ClipData::~ClipData()
+{
+    if (!fHandle)
+        return;
+    if (fFormat == CF_BITMAP) {
+        DeleteObject(fHandle);
+    } else {
+        GlobalFree(fHandle);
+    }
+}
+
+ClipData& ClipData::operator = (ClipData&& x) noexcept
+{
+    ClipData tmp(std::move(x));
+    std::swap(fFormat, tmp.fFormat);
+    std::swap(fHandle, tmp.fHandle);
+    return *this;
+}
+
+void ClipData::setToClipboard()
+{
+    auto handle = std::exchange(fHandle, nullptr);
+    if (fFormat == CF_BITMAP) {
+        setBitmapData(static_cast<HBITMAP>(handle));
+    } else {
+        setGlobalData(fFormat, handle);
+    }
+}
+
+ClipData encodeImage(const Image& im, Format fmt, Orient orient, BitmapMode bitmapMode)
+{
+    TRACE_SCOPE("encodeImage");
+    fmt = publishedFormat(fmt, bitmapMode);
+    if (isDib(fmt)) {
+        return ClipData(nativeFormat(fmt), allocGlobal(dibSize(im, fmt),
+                    [&im, fmt, orient](ByteWriter& w) { writeDib(w, im, fmt, orient); }));
+    } else if (fmt == Format::PNG) {
+        // PNG is always top-down
+        auto png = encodePng(im);
+        return ClipData(nativeFormat(fmt), allocGlobal(png.size(),
+                    [&png](ByteWriter& w) { w.write(png.data(), png.size()); }));
+    } else if (bitmapMode == BitmapMode::DIB_SECTION) {
+        return makeDibSectionData(im, [&im](char* p) {
+                    writeImageData(p, im, Orient::TOP_DOWN, Alpha::PREMULTIPLIED); });
+    } else {
+        // Also packs padded rows, CreateBitmap wants them 4-byte aligned only
+        auto premul = std::make_unique_for_overwrite<char[]>(im.nBytes());
+        writeImageData(premul.get(), im, Orient::TOP_DOWN, Alpha::PREMULTIPLIED);
+        return makeBitmapData(im, premul.get());
+    }
+}
+
+/// Runs body on locked memory of data, which stays ours
+static void withLocked(HGLOBAL data, const std::function<void(const char*)>& body)
+{
+    auto p = GlobalLock(data);
+    if (!p)
+        throw std::logic_error("Cannot lock data");
+    try {
+        body(static_cast<const char*>(p));
+    } catch (...) {
+        GlobalUnlock(data);
+        throw;
+    }
+    GlobalUnlock(data);
+}
+
+/// Copies packed pixels of DIB in orient to top-down rows
+static void copyRowsTopDown(char* dest, const char* dibPixels, Dims dims, Orient orient)
+{
+    auto rowBytes = dims.width * sizeof(Rgba);
+    auto copyRows = [&](size_t y0, size_t y1) {
+        for (size_t y = y0; y < y1; ++y) {
+            size_t dibY = (orient == Orient::TOP_DOWN) ? y : dims.height - 1 - y;
+            memcpy(dest + y * rowBytes, dibPixels + dibY * rowBytes, rowBytes);
+        }
+    };
+    if (dims.nBytes() >= PARALLEL_ENCODE_BYTES) {
+        parallelFor(dims.height, PARALLEL_MIN_ROWS, copyRows);
+    } else {
+        copyRows(0, dims.height);
+    }
+}
+
+ClipData makeBitmapData(Dims dims, const void* premultiplied)
+{
+    TRACE_SCOPE("CreateBitmap");
+    auto bm = CreateBitmap(dims.width, dims.height, 1, 32, premultiplied);
+    if (!bm)
+        throw std::logic_error("Cannot create bitmap");
+    return ClipData(CF_BITMAP, bm);
+}
+
+ClipData makeDibSectionData(Dims dims, const std::function<void(char*)>& writer)
+{
+    checkDibDims(dims);
+    BITMAPINFO info;
+    memset(&info, 0, sizeof(info));
+    info.bmiHeader.biSize = sizeof(info.bmiHeader);
+    info.bmiHeader.biWidth = dims.width;
+    info.bmiHeader.biHeight = dibHeight(dims, Orient::TOP_DOWN);
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void* bits = nullptr;
+    TRACE_SCOPE("CreateDIBSection");
+    auto bm = CreateDIBSection(nullptr, &info, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!bm || !bits) {
+        if (bm)
+            DeleteObject(bm);
+        throw std::logic_error("Cannot create DIB section");
+    }
+    // Owns bm from now on, even if writer throws
+    ClipData r(CF_BITMAP, bm);
+    writer(static_cast<char*>(bits));
+    // GDI may batch, make sure it sees our pixels
+    GdiFlush();
+    return r;
+}
+
+std::vector<ClipData> encodeImageMulti(
+        const Image& im, std::span<const Format> fmts, Orient orient,
+        BitmapMode bitmapMode)
+{
+    // One format per clipboard format, the first one wins
+    std::vector<Format> uniqueFmts;
+    for (auto fmt : fmts) {
+        fmt = publishedFormat(fmt, bitmapMode);
+        auto nf = nativeFormat(fmt);
+        if (std::none_of(uniqueFmts.begin(), uniqueFmts.end(),
+                         [nf](Format x) { return nativeFormat(x) == nf; }))
+            uniqueFmts.push_back(fmt);
+    }
+
+    // CF_DIB is straight and CF_DIBV5 premultiplied, so DIBs have nothing
+    // to share. CF_BITMAP is premultiplied too: V5 is written straight
+    // into its memory first, and CF_BITMAP copies its rows from there.
+    std::vector<ClipData> r(uniqueFmts.size());
+    auto iV5 = std::find_if(uniqueFmts.begin(), uniqueFmts.end(),
+                            [](Format x) { return nativeFormat(x) == CF_DIBV5; }) - uniqueFmts.begin();
+    if (iV5 < std::ssize(uniqueFmts))
+        r[iV5] = encodeImage(im, uniqueFmts[iV5], orient, bitmapMode);
+    for (size_t i = 0; i < uniqueFmts.size(); ++i) {
+        auto fmt = uniqueFmts[i];
+        if (r[i].handle())
+            continue;
+        if (fmt != Format::BITMAP || iV5 == std::ssize(uniqueFmts)) {
+            r[i] = encodeImage(im, fmt, orient, bitmapMode);
+            continue;
+        }
+        withLocked(r[iV5].handle(), [&](const char* dib) {
+            auto pixels = dib + (dibSize(im, uniqueFmts[iV5]) - im.nBytes());
+            if (bitmapMode == BitmapMode::DIB_SECTION) {
+                r[i] = makeDibSectionData(im, [&](char* p) {
+                            copyRowsTopDown(p, pixels, im, orient); });
+            } else if (orient == Orient::TOP_DOWN) {
+                // Same layout as CreateBitmap wants
+                r[i] = makeBitmapData(im, pixels);
+            } else {
+                auto topDown = std::make_unique_for_overwrite<char[]>(im.nBytes());
+                copyRowsTopDown(topDown.get(), pixels, im, orient);
+                r[i] = makeBitmapData(im, topDown.get());
+            }
+        });
+    }
+    return r;
+}
+
+uint32_t previewFormat(unsigned level)
+{
+    static std::mutex mutex;
+    static std::vector<uint32_t> formats;
+    std::lock_guard lock(mutex);
+    while (formats.size() < level) {
+        auto name = L"DibTest.Preview." + std::to_wstring(formats.size() + 1);
+        auto format = RegisterClipboardFormatW(name.c_str());
+        if (!format)
+            throw std::logic_error("Cannot register preview format");
+        formats.push_back(format);
+    }
+    return formats.at(level - 1);
+}
+
+std::vector<ClipData> encodeWithPreviews(const Image& im, Format fmt, Orient orient,
+                                         unsigned maxLevels)
+{
+    TRACE_SCOPE("encodeWithPreviews");
+    if (!isDib(fmt))
+        throw std::logic_error("Previews go only with DIB");
+    const Dims dims(im);
+    const unsigned nLevels = nMipLevels(dims, maxLevels);
+
+    // All blocks are written in one pass, so all are locked at once
+    std::vector<LockedGlobal> mems;
+    mems.reserve(nLevels + 1);
+    mems.emplace_back(dibSize(dims, fmt));
+    auto pixels = writeDibHeader(mems.back().data(), dims, fmt, orient);
+    std::vector<char*> mips;
+    mips.reserve(nLevels);
+    for (unsigned level = 1; level <= nLevels; ++level) {
+        auto levelDims = mipDims(dims, level);
+        mems.emplace_back(dibSize(levelDims, Format::DIB_NEW_SHORT));
+        mips.push_back(writeDibHeader(mems.back().data(), levelDims,
+                                      Format::DIB_NEW_SHORT, orient));
+    }
+    writeImageDataWithMips(pixels, im, orient, formatAlpha(fmt), mips);
+
+    std::vector<ClipData> r;
+    r.reserve(mems.size());
+    r.emplace_back(nativeFormat(fmt), mems[0].release());
+    for (unsigned level = 1; level <= nLevels; ++level)
+        r.emplace_back(previewFormat(level), mems[level].release());
+    return r;
+}
+
+void setImageData(const Image& im, Format fmt, Orient orient, BitmapMode bitmapMode)
+{
+    encodeImage(im, fmt, orient, bitmapMode).setToClipboard();
+}
+
+ClipData encodeRows(RowSource& src, Format fmt, Orient orient, BitmapMode bitmapMode)
+{
+    fmt = publishedFormat(fmt, bitmapMode);
+    Dims dims(src.width(), src.height());
+    if (fmt == Format::BITMAP && bitmapMode == BitmapMode::DIB_SECTION) {
+        return makeDibSectionData(dims, [&src](char* p) {
+                    writeImageData(p, src, Orient::TOP_DOWN, Alpha::PREMULTIPLIED); });
+    }
+    if (!isDib(fmt))
+        return encodeImage(toImage(src), fmt, orient, bitmapMode);
+    return ClipData(nativeFormat(fmt), allocGlobal(dibSize(dims, fmt),
+                [&src, fmt, orient](ByteWriter& w) { writeDib(w, src, fmt, orient); }));
+}
+
+GlobalPool::~GlobalPool()
+{
+    for (auto data : fSpares)
+        GlobalFree(data);
+}
+
+HGLOBAL GlobalPool::take(size_t nBytes)
+{
+    // Exact size first: consumers of some formats trust GlobalSize
+    auto it = std::find_if(fSpares.begin(), fSpares.end(),
+            [nBytes](HGLOBAL x) { return GlobalSize(x) == nBytes; });
+    if (it == fSpares.end() && !fSpares.empty())
+        it = fSpares.end() - 1;
+    if (it != fSpares.end()) {
+        auto data = *it;
+        fSpares.erase(it);
+        if (GlobalSize(data) == nBytes)
+            return data;
+        if (auto resized = GlobalReAlloc(data, nBytes, GMEM_MOVEABLE))
+            return resized;
+        GlobalFree(data);
+    }
+    auto data = GlobalAlloc(GMEM_MOVEABLE, nBytes);
+    if (!data)
+        throw std::logic_error("Cannot allocate data");
+    return data;
+}
+
+HGLOBAL GlobalPool::alloc(size_t nBytes, const std::function<void(ByteWriter&)>& writer)
+{
+    auto globalData = take(nBytes);
+    auto copyData = GlobalLock(globalData);
+    if (!copyData) {
+        GlobalFree(globalData);
+        throw std::logic_error("Cannot lock data");
+    }
+    try {
+        ByteWriter w(static_cast<char*>(copyData), nBytes);
+        writer(w);
+        w.checkFull();
+    } catch (...) {
+        GlobalUnlock(globalData);
+        recycle(globalData);
+        throw;
+    }
+    GlobalUnlock(globalData);
+    return globalData;
+}
+
+void GlobalPool::reserve(size_t nBytes)
+{
+    recycle(take(nBytes));
+}
+
+void GlobalPool::recycle(HGLOBAL data)
+{
+    if (!data)
+        return;
+    if (fSpares.size() < fMaxSpares) {
+        fSpares.push_back(data);
+    } else {
+        GlobalFree(data);
+    }
+}
+
+char* DibEncoder::scratch(size_t nBytes)
+{
+    // Shrinking vector keeps its capacity
+    fScratch.resize(nBytes);
+    return fScratch.data();
+}
+
+void DibEncoder::updateLast(const Image& im, Format fmt, Orient orient)
+{
+    auto nBytes = dibSize(im, fmt);
+    // Id changes on resize, so same id means same size; adopted pixels
+    // are written by their owner, behind the stamps' back
+    bool isSame = !im.isAdopted() && fLast.imageId == im.id() && fLast.format == fmt
+            && fLast.orient == orient && fLast.data.size() == nBytes;
+    auto since = fLast.version;
+    auto version = im.closeVersion();
+    // Invalid until done, in case of exception
+    fLast.imageId = 0;
+    if (!isSame) {
+        auto w = fLast.data.writer(nBytes);
+        writeDib(w, im, fmt, orient);
+    } else {
+        auto pixels = fLast.data.bytes().data() + (nBytes - im.nBytes());
+        auto rowBytes = im.width() * sizeof(Rgba);
+        auto alpha = formatAlpha(fmt);
+        auto h = im.height();
+        for (size_t y = 0; y < h; ++y) {
+            if (im.rowVersion(y) > since) {
+                size_t dibY = (orient == Orient::TOP_DOWN) ? y : h - 1 - y;
+                copyRow(pixels + dibY * rowBytes, im.uncheckedScanLine(y), alpha);
+            }
+        }
+    }
+    fLast.imageId = im.id();
+    fLast.version = version;
+    fLast.format = fmt;
+    fLast.orient = orient;
+}
+
+void DibEncoder::forgetLast()
+{
+    fLast = {};
+}
+
+std::span<const char> DibEncoder::makeDib(const Image& im, Format fmt, Orient orient)
+{
+    if (!isDib(fmt))
+        throw std::logic_error("Format is not DIB");
+    updateLast(im, fmt, orient);
+    return std::as_const(fLast.data).bytes();
+}
+
+ClipData DibEncoder::encode(const Image& im, Format fmt, Orient orient, BitmapMode bitmapMode)
+{
+    fmt = publishedFormat(fmt, bitmapMode);
+    if (isDib(fmt)) {
+        auto dib = makeDib(im, fmt, orient);
+        return ClipData(nativeFormat(fmt), fPool.alloc(dib.size(),
+                    [dib](ByteWriter& w) {
+                        TRACE_SCOPE("memcpy");
+                        w.write(dib.data(), dib.size());
+                    }));
+    } else if (fmt == Format::PNG) {
+        encodePng(im, fPng);
+        return ClipData(nativeFormat(fmt), fPool.alloc(fPng.size(),
+                    [this](ByteWriter& w) { w.write(fPng.data(), fPng.size()); }));
+    } else if (bitmapMode == BitmapMode::DIB_SECTION) {
+        return encodeImage(im, fmt, orient, bitmapMode);
+    } else {
+        auto premul = scratch(im.nBytes());
+        writeImageData(premul, im, Orient::TOP_DOWN, Alpha::PREMULTIPLIED);
+        return makeBitmapData(im, premul);
+    }
+}
+
+void DibEncoder::publish(ClipData data)
+{
+    if (data.nativeFormat() == CF_BITMAP) {
+        data.setToClipboard();
+        return;
+    }
+    TRACE_SCOPE("SetClipboardData");
+    if (!SetClipboardData(data.nativeFormat(), data.handle())) {
+        recycle(std::move(data));
+        throw std::logic_error("Cannot set clipboard data");
+    }
+    // System owns it now
+    data.release();
+}
+
+void DibEncoder::recycle(ClipData data)
+{
+    if (data.nativeFormat() != CF_BITMAP)
+        fPool.recycle(data.release());
+}
+
+DibCache::Key DibCache::keyOf(const Image& im, Format fmt, Orient orient)
+{
+    uint64_t hash;
+    {
+        TRACE_SCOPE("hashImage");
+        hash = hashImage(im);
+    }
+    return Key { .hash = hash, .width = im.width(), .height = im.height(),
+                 .format = fmt, .orient = orient };
+}
+
+std::span<const char> DibCache::payload(const Key& key, const Image& im)
+{
+    auto& entries = fEntries[key.format];
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [&key](const Entry& x) { return x.key == key; });
+    if (it != entries.end()) {
+        ++fNHits;
+        TRACE_COUNT("DibCache.hits", 1);
+        std::rotate(entries.begin(), it, it + 1);
+        return entries.front().data.bytes();
+    }
+    ++fNMisses;
+    Entry entry;
+    entry.key = key;
+    if (key.format == Format::PNG) {
+        auto png = encodePng(im);
+        entry.data.writer(png.size()).write(png.data(), png.size());
+    } else {
+        auto w = entry.data.writer(dibSize(im, key.format));
+        writeDib(w, im, key.format, key.orient);
+    }
+    if (entries.size() >= fNPerFormat && !entries.empty())
+        entries.pop_back();
+    entries.insert(entries.begin(), std::move(entry));
+    return entries.front().data.bytes();
+}
+
+ClipData DibCache::encode(const Key& key, const Image& im, BitmapMode bitmapMode)
+{
+    auto fmt = publishedFormat(key.format, bitmapMode);
+    if (fmt == Format::BITMAP || fNPerFormat == 0)
+        return encodeImage(im, fmt, key.orient, bitmapMode);
+    Key published = key;
+    published.format = fmt;
+    auto bytes = payload(published, im);
+    return ClipData(nativeFormat(fmt), allocGlobal(bytes.size(),
+                [bytes](ByteWriter& w) { w.write(bytes.data(), bytes.size()); }));
+}
+
+void DibCache::setPublished(const Key& key)
+{
+    fPublished = key;
+    fPublishedSequence = clipboardSequence();
+}
+
+bool DibCache::isPublished(const Key& key) const
+{
+    return fPublished == key && fPublishedSequence != 0
+            && clipboardSequence() == fPublishedSequence;
+}
+
+void DibCache::clear()
+{
+    fEntries.clear();
+    fPublished.reset();
+}
+
+/// Files spilled and not removed yet; what is left goes at exit
+struct SpillFiles {
+    std::vector<std::wstring> paths;
+
+    ~SpillFiles()
+    {
+        for (auto& path : paths)
+            DeleteFileW(path.c_str());
+    }
+};
+
+static std::mutex spillMutex;
+static SpillFiles spillFiles;
+static unsigned lastSpillIndex = 0;
+
+std::wstring spillToFile(const SpillPolicy& policy, const wchar_t* extension,
+                         size_t nBytes, const std::function<void(ByteWriter&)>& writer)
+{
+    TRACE_SCOPE("spillToFile");
+    std::wstring path = policy.directory;
+    if (path.empty()) {
+        std::array<wchar_t, MAX_PATH + 1> temp;
+        auto len = GetTempPathW(temp.size(), temp.data());
+        if (len == 0 || len > temp.size())
+            throw std::logic_error("Cannot get temp folder");
+        path.assign(temp.data(), len);
+    } else if (path.back() != L'\\' && path.back() != L'/') {
+        path += L'\\';
+    }
+    unsigned index;
+    {
+        std::lock_guard lk(spillMutex);
+        index = ++lastSpillIndex;
+    }
+    path += L"DibTest-" + std::to_wstring(GetCurrentProcessId())
+            + L"-" + std::to_wstring(index) + extension;
+
+    auto file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::logic_error("Cannot create spill file");
+    // Frees what is left on the way out, file goes away if not written
+    auto cleanup = [&](HANDLE mapping, void* view, bool isOk) {
+        if (view)
+            UnmapViewOfFile(view);
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        if (!isOk)
+            DeleteFileW(path.c_str());
+    };
+    auto mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                      static_cast<DWORD>(uint64_t(nBytes) >> 32),
+                                      static_cast<DWORD>(nBytes), nullptr);
+    if (!mapping) {
+        cleanup(nullptr, nullptr, false);
+        throw std::logic_error("Cannot map spill file");
+    }
+    auto view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, nBytes);
+    if (!view) {
+        cleanup(mapping, nullptr, false);
+        throw std::logic_error("Cannot map spill file");
+    }
+    try {
+        ByteWriter w(static_cast<char*>(view), nBytes);
+        writer(w);
+        w.checkFull();
+    } catch (...) {
+        cleanup(mapping, view, false);
+        throw;
+    }
+    // Pages are file-backed: system writes them out and trims them
+    cleanup(mapping, view, true);
+
+    std::lock_guard lk(spillMutex);
+    spillFiles.paths.push_back(path);
+    return path;
+}
+
+void removeSpillFiles()
+{
+    std::lock_guard lk(spillMutex);
+    for (auto& path : spillFiles.paths)
+        DeleteFileW(path.c_str());
+    spillFiles.paths.clear();
+}
+
+ClipData makeDropData(std::span<const std::wstring> paths)
+{
+    // DROPFILES, then paths, each with null, and one more null
+    size_t nChars = 1;
+    for (auto& path : paths)
+        nChars += path.size() + 1;
+    auto nBytes = sizeof(DROPFILES) + nChars * sizeof(wchar_t);
+    return ClipData(CF_HDROP, allocGlobal(nBytes, [&paths](ByteWriter& w) {
+        DROPFILES header;
+        memset(&header, 0, sizeof(header));
+        header.pFiles = sizeof(header);
+        header.fWide = TRUE;
+        w.write(header);
+        constexpr wchar_t NUL = 0;
+        for (auto& path : paths) {
+            w.write(path.data(), path.size() * sizeof(wchar_t));
+            w.write(NUL);
+        }
+        w.write(NUL);
+    }));
+}
+
+constexpr const wchar_t* MESSAGE_WINDOW_CLASS = L"DibTest.MessageWindow";
+
+MessageWindow::MessageWindow()
+{
+    auto instance = GetModuleHandleW(nullptr);
+    WNDCLASSW wc;
+    memset(&wc, 0, sizeof(wc));
+    wc.lpfnWndProc = wndProc;
+    wc.hInstance = instance;
+    wc.lpszClassName = MESSAGE_WINDOW_CLASS;
+    if (!RegisterClassW(&wc) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS)
+        throw std::logic_error("Cannot register window class");
+    fHandle = CreateWindowExW(0, MESSAGE_WINDOW_CLASS, L"", 0, 0, 0, 0, 0,
+                              HWND_MESSAGE, nullptr, instance, nullptr);
+    if (!fHandle)
+        throw std::logic_error("Cannot create message window");
+    SetWindowLongPtrW(fHandle, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+}
+
+MessageWindow::~MessageWindow()
+{
+    destroy();
+}
+
+void MessageWindow::destroy()
+{
+    if (fHandle) {
+        DestroyWindow(fHandle);
+        fHandle = nullptr;
+    }
+}
+
+void MessageWindow::processMessages()
+{
+    MSG msg;
+    while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+}
+
+LRESULT MessageWindow::handleMessage(UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    return DefWindowProcW(fHandle, msg, wParam, lParam);
+}
+
+LRESULT CALLBACK MessageWindow::wndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    auto that = reinterpret_cast<MessageWindow*>(GetWindowLongPtrW(hwnd, GWLP_USERDATA));
+    if (!that)
+        return DefWindowProcW(hwnd, msg, wParam, lParam);
+    return that->handleMessage(msg, wParam, lParam);
+}
+
+
+ClipboardOwner::~ClipboardOwner()
+{
+    // Renders what remains, while we are still ClipboardOwner
+    destroy();
+}
+
+void ClipboardOwner::addPending(std::shared_ptr<const Image> im, Format fmt, Orient orient,
+                                BitmapMode bitmapMode)
+{
+    fmt = publishedFormat(fmt, bitmapMode);
+    fPending[nativeFormat(fmt)] = Pending {
+            .image = std::move(im), .format = fmt, .orient = orient,
+            .bitmapMode = bitmapMode };
+}
+
+void ClipboardOwner::render(uint32_t nativeFormat)
+{
+    auto it = fPending.find(nativeFormat);
+    if (it == fPending.end())
+        return;
+    // Cannot throw through window procedure
+    try {
+        auto& pending = it->second;
+        setImageData(*pending.image, pending.format, pending.orient, pending.bitmapMode);
+    } catch (const std::exception&) {}
+    fPending.erase(it);
+}
+
+void ClipboardOwner::renderAll()
+{
+    if (!OpenClipboard(handle()))
+        return;
+    // Someone could have emptied clipboard before we opened it
+    if (GetClipboardOwner() == handle()) {
+        while (!fPending.empty())
+            render(fPending.begin()->first);
+    }
+    CloseClipboard();
+}
+
+LRESULT ClipboardOwner::handleMessage(UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    switch (msg) {
+    case WM_RENDERFORMAT:
+        render(wParam);
+        return 0;
+    case WM_RENDERALLFORMATS:
+        renderAll();
+        return 0;
+    case WM_DESTROYCLIPBOARD:
+        fPending.clear();
+        return 0;
+    default:
+        return MessageWindow::handleMessage(msg, wParam, lParam);
+    }
+}
+
+
+DWORD clipboardSequence()
+{
+    return GetClipboardSequenceNumber();
+}
+
+ClipboardListener::ClipboardListener(OnChange onChange)
+    : fOnChange(std::move(onChange)), fLastSequence(clipboardSequence())
+{
+    if (!AddClipboardFormatListener(handle()))
+        throw std::logic_error("Cannot listen to clipboard");
+}
+
+ClipboardListener::~ClipboardListener()
+{
+    RemoveClipboardFormatListener(handle());
+}
+
+LRESULT ClipboardListener::handleMessage(UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    if (msg != WM_CLIPBOARDUPDATE)
+        return MessageWindow::handleMessage(msg, wParam, lParam);
+    auto sequence = clipboardSequence();
+    if (sequence == fLastSequence)
+        return 0;
+    fLastSequence = sequence;
+    DWORD ownerPid = 0;
+    if (auto owner = GetClipboardOwner())
+        GetWindowThreadProcessId(owner, &ownerPid);
+    // Cannot throw through window procedure
+    try {
+        fOnChange(ClipboardChange {
+                .sequence = sequence, .isOurs = (ownerPid == GetCurrentProcessId()) });
+    } catch (const std::exception&) {}
+    return 0;
+}
+
+
+ClipboardWatcher::ClipboardWatcher(ClipboardListener::OnChange onChange)
+{
+    // Window belongs to the thread that creates it, so thread makes it
+    std::promise<DWORD> started;
+    auto isStarted = started.get_future();
+    fThread = std::thread([&started, onChange = std::move(onChange)]() mutable {
+        std::unique_ptr<ClipboardListener> listener;
+        try {
+            listener = std::make_unique<ClipboardListener>(std::move(onChange));
+        } catch (...) {
+            started.set_exception(std::current_exception());
+            return;
+        }
+        started.set_value(GetCurrentThreadId());
+        MSG msg;
+        while (GetMessageW(&msg, nullptr, 0, 0) > 0) {
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+    });
+    try {
+        fThreadId = isStarted.get();
+    } catch (...) {
+        fThread.join();
+        throw;
+    }
+}
+
+ClipboardWatcher::~ClipboardWatcher()
+{
+    PostThreadMessageW(fThreadId, WM_QUIT, 0, 0);
+    fThread.join();
+}
+
+
+static std::mutex statsMutex;
+static ContentionStats stats;
+
+ContentionStats clipboardStats()
+{
+    std::lock_guard lock(statsMutex);
+    return stats;
+}
+
+void resetClipboardStats()
+{
+    std::lock_guard lock(statsMutex);
+    stats = ContentionStats{};
+}
+
+/// Opens clipboard according to policy, counting what happens
+static void openClipboard(HWND owner, const OpenPolicy& policy)
+{
+    using Clock = std::chrono::steady_clock;
+    TRACE_SCOPE("OpenClipboard");
+
+    auto delay = policy.firstDelay;
+    HWND blocker = nullptr;
+    unsigned nAttempts = 0;
+    Clock::duration waitTime {};
+    bool isOpen = false;
+    while (true) {
+        ++nAttempts;
+        if (OpenClipboard(owner)) {
+            isOpen = true;
+            break;
+        }
+        blocker = GetOpenClipboardWindow();
+        if (nAttempts >= policy.maxAttempts)
+            break;
+        auto start = Clock::now();
+        if (nAttempts <= policy.nSpins) {
+            SwitchToThread();
+        } else {
+            Sleep(delay.count());
+            delay = std::min(delay * 2, policy.maxDelay);
+        }
+        waitTime += Clock::now() - start;
+    }
+
+    DWORD blockerPid = 0;
+    if (blocker)
+        GetWindowThreadProcessId(blocker, &blockerPid);
+    {
+        std::lock_guard lock(statsMutex);
+        stats.nAttempts += nAttempts;
+        stats.waitTime += std::chrono::duration_cast<std::chrono::microseconds>(waitTime);
+        if (isOpen) {
+            ++stats.nOpens;
+        } else {
+            ++stats.nFailures;
+        }
+        if (blocker) {
+            stats.lastBlocker = blocker;
+            stats.lastBlockerPid = blockerPid;
+        }
+    }
+    if (!isOpen) {
+        std::string msg = "Cannot open clipboard";
+        if (blockerPid)
+            msg += ": held by process " + std::to_string(blockerPid);
+        throw std::logic_error(msg);
+    }
+}
+
+Clipboard::Clipboard(const OpenPolicy& policy)
+{
+    openClipboard(nullptr, policy);
+}
+
+Clipboard::Clipboard(ClipboardOwner& owner, const OpenPolicy& policy) : fOwner(&owner)
+{
+    openClipboard(owner.handle(), policy);
+}
+
+Clipboard::~Clipboard()
+{
+    releaseViews();
+    TRACE_SCOPE("CloseClipboard");
+    CloseClipboard();
+}
+
+void Clipboard::releaseViews()
+{
+    fViews.clear();
+}
+
+void Clipboard::clearIf()
+{
+    if (needClear) {
+        releaseViews();
+        TRACE_SCOPE("EmptyClipboard");
+        EmptyClipboard();
+        needClear = false;
+    }
+}
+
+void Clipboard::copyRaw(uint32_t nativeFormat, std::string_view data)
+{
+    copyInPlace(nativeFormat, data.size(), [data](char* p) {
+        TRACE_SCOPE("memcpy");
+        memcpy(p, data.data(), data.size());
+    });
+}
+
+void Clipboard::spill(const wchar_t* extension, size_t nBytes,
+                      const std::function<void(ByteWriter&)>& writer)
+{
+    // Earlier files left clipboard with EmptyClipboard; this session’s
+    // first spill replaces them. Later ones join it on clipboard.
+    if (!hasSpilled) {
+        removeSpillFiles();
+        hasSpilled = true;
+    }
+    auto path = spillToFile(fSpillPolicy, extension, nBytes, writer);
+    makeDropData({ &path, 1 }).setToClipboard();
+}
+
+void Clipboard::copyInPlace(uint32_t nativeFormat, size_t nBytes,
+                            const std::function<void(char*)>& writer)
+{
+    clearIf();
+    if (fSpillPolicy.isSpilled(nBytes)) {
+        spill(L".bin", nBytes, [nBytes, &writer](ByteWriter& w) { writer(w.take(nBytes)); });
+        return;
+    }
+    setGlobalData(nativeFormat, allocGlobal(nBytes, writer));
+}
+
+void Clipboard::copyBitmap(const Image& im)
+{
+    clearIf();
+    setImageData(im, Format::BITMAP, Orient::TOP_DOWN, fBitmapMode);
+}
+
+
+void Clipboard::copyImage(const Image& im, Format fmt, Orient orient)
+{
+    TRACE_SCOPE("Clipboard::copyImage");
+    clearIf();
+    if (fmt != Format::PNG && fSpillPolicy.isSpilled(bmpFileSize(im, fmt))) {
+        spill(L".bmp", bmpFileSize(im, fmt),
+              [&im, fmt, orient](ByteWriter& w) { writeBmpFile(w, im, fmt, orient); });
+        return;
+    }
+    setImageData(im, fmt, orient, fBitmapMode);
+}
+
+
+void Clipboard::copyImage(DibCache& cache, const Image& im, Format fmt, Orient orient)
+{
+    TRACE_SCOPE("Clipboard::copyImage(cache)");
+    auto key = cache.keyOf(im, fmt, orient);
+    clearIf();
+    cache.encode(key, im, fBitmapMode).setToClipboard();
+    cache.setPublished(key);
+}
+
+
+bool copyImageCached(DibCache& cache, const Image& im, Format fmt, Orient orient,
+                     const OpenPolicy& policy, BitmapMode bitmapMode)
+{
+    // Checked before opening: a skip must not leave an open clipboard
+    // that later copies would add to
+    auto key = cache.keyOf(im, fmt, orient);
+    if (cache.isPublished(key)) {
+        TRACE_COUNT("DibCache.skips", 1);
+        return false;
+    }
+    auto data = cache.encode(key, im, bitmapMode);
+    Clipboard clip(policy);
+    clip.copyEncoded(std::span(&data, 1));
+    cache.setPublished(key);
+    return true;
+}
+
+
+void Clipboard::copyImage(DibEncoder& encoder, const Image& im, Format fmt, Orient orient)
+{
+    clearIf();
+    encoder.publish(encoder.encode(im, fmt, orient, fBitmapMode));
+}
+
+
+void Clipboard::copyRows(RowSource& src, Format fmt, Orient orient)
+{
+    clearIf();
+    encodeRows(src, fmt, orient, fBitmapMode).setToClipboard();
+}
+
+
+void Clipboard::copyImage(std::shared_ptr<const Image> im, Format fmt, Orient orient)
+{
+    if (!fOwner) {
+        copyImage(*im, fmt, orient);
+        return;
+    }
+    // EmptyClipboard makes owner window clipboard owner
+    clearIf();
+    auto nf = nativeFormat(publishedFormat(fmt, fBitmapMode));
+    fOwner->addPending(std::move(im), fmt, orient, fBitmapMode);
+    TRACE_SCOPE("SetClipboardData");
+    // Delayed rendering gives no handle back: only last error tells failure
+    SetLastError(ERROR_SUCCESS);
+    if (!SetClipboardData(nf, nullptr) && GetLastError() != ERROR_SUCCESS) {
+        fOwner->removePending(nf);
+        throw std::logic_error("Cannot set clipboard data");
+    }
+}
+
+void Clipboard::copyImageMulti(const Image& im, std::span<const Format> fmts,
+                               Orient orient)
+{
+    clearIf();
+    for (auto& data : encodeImageMulti(im, fmts, orient, fBitmapMode))
+        data.setToClipboard();
+}
+
+
+void Clipboard::copyImageWithPreviews(const Image& im, Format fmt, unsigned maxLevels,
+                                      Orient orient)
+{
+    clearIf();
+    for (auto& data : encodeWithPreviews(im, fmt, orient, maxLevels))
+        data.setToClipboard();
+}
+
+
+void Clipboard::copyEncoded(std::span<ClipData> datas)
+{
+    clearIf();
+    try {
+        for (auto& data : datas)
+            data.setToClipboard();
+    } catch (...) {
+        // All or nothing: drop formats set so far, rest are still ours
+        EmptyClipboard();
+        throw;
+    }
+}
+
+
+/// CF_DIBV5 or CF_DIB, richer first; null handle if clipboard has neither
+static std::pair<HANDLE, Alpha> clipboardDib()
+{
+    for (uint32_t fmt : { CF_DIBV5, CF_DIB }) {
+        if (IsClipboardFormatAvailable(fmt)) {
+            if (auto handle = GetClipboardData(fmt))
+                return { handle, (fmt == CF_DIBV5) ? Alpha::PREMULTIPLIED : Alpha::STRAIGHT };
+        }
+    }
+    return { nullptr, Alpha::STRAIGHT };
+}
+
+Image Clipboard::pasteImage()
+{
+    auto [handle, alpha] = clipboardDib();
+    if (!handle)
+        return {};
+    Image r;
+    withLocked(handle, [&, alpha](const char* p) {
+        std::span<const char> dib { p, GlobalSize(handle) };
+        r = decodeDib(dib, parseDib(dib), alpha);
+    });
+    return r;
+}
+
+ClipboardView Clipboard::viewImage()
+{
+    auto [handle, alpha] = clipboardDib();
+    if (!handle)
+        return {};
+    auto p = static_cast<const char*>(GlobalLock(handle));
+    if (!p)
+        throw std::logic_error("Cannot lock clipboard data");
+    Image view;
+    try {
+        auto layout = parseDib({ p, GlobalSize(handle) });
+        if (!layout.isImageLayout()) {
+            GlobalUnlock(handle);
+            return {};
+        }
+        // Image has no const flavour: view is only handed out as const
+        auto pixels = const_cast<Rgba*>(
+                reinterpret_cast<const Rgba*>(p + layout.pixelOffset));
+        view = Image::adopt(pixels, layout.width, layout.height,
+                            [handle](Rgba*) { GlobalUnlock(handle); });
+    } catch (...) {
+        GlobalUnlock(handle);
+        throw;
+    }
+    // From here on view’s deleter unlocks
+    fViews.push_back(std::make_unique<const Image>(std::move(view)));
+    return { fViews.back().get(), alpha };
+}
+
+
+void Win32Backend::copyImage(std::shared_ptr<const Image> im, std::span<const Format> fmts,
+                             Orient orient)
+{
+    // Encoded before clipboard is opened, to keep it held shortly
+    auto datas = encodeImageMulti(*im, fmts, orient, fBitmapMode);
+    Clipboard clip(fPolicy);
+    clip.copyEncoded(datas);
+}
+
+
+std::shared_ptr<const Image> Win32Backend::pasteImage()
+{
+    Clipboard clip(fPolicy);
+    auto im = clip.pasteImage();
+    if (im.area() == 0)
+        return nullptr;
+    return std::make_shared<const Image>(std::move(im));
+}
+
+
+std::future<void> copyImageAsync(
+        std::shared_ptr<const Image> im, std::vector<Format> fmts, Orient orient,
+        const OpenPolicy& policy, BitmapMode bitmapMode)
+{
+    return std::async(std::launch::async,
+        [im = std::move(im), fmts = std::move(fmts), orient, policy, bitmapMode] {
+            // Encodes while nobody is locked out, then holds the clipboard
+            // only to hand the data over
+            Win32Backend(policy, bitmapMode).copyImage(im, fmts, orient);
+        });
+}
+
+
+namespace {
+
+    ///
+    ///  Single worker for copies with callbacks: they run in order. Joined at
+    ///  exit once queued copies are done, before ThreadPool they encode in.
+    ///
+    class CopyWorker
+    {
+    public:
+        static CopyWorker& instance()
+        {
+            // Constructed first, so destroyed after us
+            ThreadPool::instance();
+            static CopyWorker inst;
+            return inst;
+        }
+
+        ~CopyWorker()
+        {
+            {
+                std::lock_guard lock(fMutex);
+                fQuit = true;
+            }
+            fWake.notify_all();
+            fThread.join();
+        }
+
+        void post(std::function<void()> job)
+        {
+            {
+                std::lock_guard lock(fMutex);
+                fJobs.push_back(std::move(job));
+            }
+            fWake.notify_one();
+        }
+    private:
+        CopyWorker() : fThread([this] { loop(); }) {}
+
+        void loop()
+        {
+            for (;;) {
+                std::function<void()> job;
+                {
+                    std::unique_lock lock(fMutex);
+                    fWake.wait(lock, [this] { return fQuit || !fJobs.empty(); });
+                    // Quits only when drained
+                    if (fJobs.empty())
+                        return;
+                    job = std::move(fJobs.front());
+                    fJobs.pop_front();
+                }
+                job();
+            }
+        }
+
+        std::mutex fMutex;
+        std::condition_variable fWake;
+        std::deque<std::function<void()>> fJobs;
+        bool fQuit = false;
+        /// Last, to start when the rest is ready
+        std::thread fThread;
+    };
+
+}   // anon namespace
+
+
+void copyImageAsync(
+        std::shared_ptr<const Image> im, std::vector<Format> fmts, Orient orient,
+        std::function<void(std::exception_ptr)> onDone, const OpenPolicy& policy,
+        BitmapMode bitmapMode)
+{
+    CopyWorker::instance().post([im = std::move(im), fmts = std::move(fmts), orient,
+                                 onDone = std::move(onDone), policy, bitmapMode] {
+        std::exception_ptr error;
+        try {
+            Win32Backend(policy, bitmapMode).copyImage(im, fmts, orient);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (onDone)
+            onDone(error);
+    });
+}
+
+
+void ClipboardTransaction::add(uint32_t nativeFormat, std::function<ClipData()> encoder,
+                               bool splitsItself)
+{
+    auto it = std::find_if(fItems.begin(), fItems.end(),
+            [nativeFormat](const Item& x) { return x.nativeFormat == nativeFormat; });
+    if (it != fItems.end()) {
+        it->encoder = std::move(encoder);
+        it->data = {};
+        it->splitsItself = splitsItself;
+    } else {
+        fItems.push_back(Item {
+                .nativeFormat = nativeFormat, .encoder = std::move(encoder), .data = {},
+                .splitsItself = splitsItself });
+    }
+}
+
+void ClipboardTransaction::addRaw(uint32_t nativeFormat, std::string data)
+{
+    add(nativeFormat, [nativeFormat, data = std::move(data)] {
+        return ClipData(nativeFormat, allocGlobal(data.size(), [&data](ByteWriter& w) {
+            w.write(data.data(), data.size());
+        }));
+    });
+}
+
+void ClipboardTransaction::addText(std::wstring_view text)
+{
+    // UTF-16 with terminating null
+    std::string data((text.size() + 1) * sizeof(wchar_t), '\0');
+    memcpy(data.data(), text.data(), text.size() * sizeof(wchar_t));
+    addRaw(CF_UNICODETEXT, std::move(data));
+}
+
+void ClipboardTransaction::addCustom(const wchar_t* formatName, std::string data)
+{
+    auto nativeFormat = RegisterClipboardFormatW(formatName);
+    if (!nativeFormat)
+        throw std::logic_error("Cannot register clipboard format");
+    addRaw(nativeFormat, std::move(data));
+}
+
+void ClipboardTransaction::addInPlace(uint32_t nativeFormat, size_t nBytes,
+                                      std::function<void(char*)> writer)
+{
+    add(nativeFormat, [nativeFormat, nBytes, writer = std::move(writer)] {
+        return ClipData(nativeFormat, allocGlobal(nBytes, writer));
+    });
+}
+
+void ClipboardTransaction::addImage(std::shared_ptr<const Image> im, Format fmt, Orient orient)
+{
+    auto bitmapMode = fBitmapMode;
+    // PNG splits into strips, big DIBs into row blocks
+    bool splitsItself = fmt == Format::PNG || im->nBytes() >= PARALLEL_ENCODE_BYTES;
+    add(nativeFormat(publishedFormat(fmt, bitmapMode)),
+        [im = std::move(im), fmt, orient, bitmapMode] {
+            return encodeImage(*im, fmt, orient, bitmapMode);
+        }, splitsItself);
+}
+
+void ClipboardTransaction::encodeItems(std::vector<Item>& items)
+{
+    TRACE_SCOPE("ClipboardTransaction::encode");
+    // Items that split themselves get the whole pool one after another,
+    // inside a pool task they would run serially
+    std::vector<Item*> todo;
+    for (auto& item : items) {
+        if (item.data.handle())
+            continue;
+        if (item.splitsItself) {
+            item.data = item.encoder();
+        } else {
+            todo.push_back(&item);
+        }
+    }
+    ThreadPool::instance().run(todo.size(), [&todo](size_t i) {
+        todo[i]->data = todo[i]->encoder();
+    });
+}
+
+void ClipboardTransaction::encode()
+{
+    encodeItems(fItems);
+}
+
+void ClipboardTransaction::commit()
+{
+    // Empty afterwards, whatever happens
+    auto items = std::exchange(fItems, {});
+    encodeItems(items);
+    std::vector<ClipData> datas;
+    datas.reserve(items.size());
+    for (auto& item : items)
+        datas.push_back(std::move(item.data));
+
+    TRACE_SCOPE("ClipboardTransaction::commit");
+    Clipboard clip(fPolicy);
+    clip.copyEncoded(datas);
+}
@@ -0,0 +1,630 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+#include "backend.h"
+#include "dib.h"
+
+/// @return  clipboard format that fmt is published under
+uint32_t nativeFormat(Format fmt);
+
+/// Allocates exactly nBytes of global memory and lets writer fill it
+/// in place, without intermediate buffers
+/// @return  unlocked memory, owned by caller
+HGLOBAL allocGlobal(size_t nBytes, const std::function<void(char*)>& writer);
+/// Same, writer should write exactly nBytes
+HGLOBAL allocGlobal(size_t nBytes, const std::function<void(ByteWriter&)>& writer);
+
+/// Puts memory to clipboard that is already open, or (while handling
+/// WM_RENDERFORMAT) not open at all. Takes ownership of data.
+void setGlobalData(uint32_t nativeFormat, HGLOBAL data);
+
+/// Same for bitmap
+void setBitmapData(HBITMAP bm);
+
+///
+///  Encoded clipboard data: global memory, or bitmap for CF_BITMAP.
+///  Frees it unless it was given to clipboard.
+///
+class ClipData
+{
+public:
+    ClipData() = default;
+    ClipData(uint32_t nativeFormat, HANDLE handle);
+    ~ClipData();
+    ClipData(ClipData&& x) noexcept
+        : fFormat(x.fFormat), fHandle(std::exchange(x.fHandle, nullptr)) {}
+    ClipData& operator = (ClipData&& x) noexcept;
+
+    uint32_t nativeFormat() const { return fFormat; }
+    HANDLE handle() const { return fHandle; }
+    /// Same rules as setGlobalData
+    void setToClipboard();
+    /// Gives handle away, to caller
+    HANDLE release() { return std::exchange(fHandle, nullptr); }
+private:
+    uint32_t fFormat = 0;
+    HANDLE fHandle = nullptr;
+};
+
+/// How CF_BITMAP is made
+enum class BitmapMode {
+    /// CreateBitmap: kernel copies pixels to device-dependent bitmap
+    DDB,
+    /// CreateDIBSection: pixels are written in place into the section
+    DIB_SECTION,
+    /// No CF_BITMAP at all: CF_DIBV5 goes instead, and Windows
+    /// synthesizes CF_BITMAP if someone asks for it
+    SYNTHESIZE
+};
+
+/// @return  format that is really published for fmt
+inline Format publishedFormat(Format fmt, BitmapMode mode)
+{
+    return (fmt == Format::BITMAP && mode == BitmapMode::SYNTHESIZE)
+            ? Format::DIB_NEW_SHORT : fmt;
+}
+
+/// Encodes image; needs no open clipboard
+ClipData encodeImage(const Image& im, Format fmt, Orient orient,
+                     BitmapMode bitmapMode = BitmapMode::DDB);
+
+/// Encodes image in several formats. Formats that end up under the same
+/// clipboard format are encoded once, the first of them wins.
+/// CF_BITMAP copies premultiplied pixels of CF_DIBV5 if that is there.
+std::vector<ClipData> encodeImageMulti(
+        const Image& im, std::span<const Format> fmts, Orient orient,
+        BitmapMode bitmapMode = BitmapMode::DDB);
+
+/// Registered format of preview level (1 = half size…); its data is
+/// laid out as CF_DIBV5, premultiplied
+uint32_t previewFormat(unsigned level);
+
+/// Encodes DIB of im and, in the same pass, up to maxLevels previews
+/// halving it again and again (see scale.h), so that consumers can pick
+/// one close to their size instead of downscaling the whole image.
+/// @return  DIB, then previews from the biggest
+std::vector<ClipData> encodeWithPreviews(const Image& im, Format fmt, Orient orient,
+                                         unsigned maxLevels);
+
+/// Encodes image and puts it to clipboard, under the same rules
+void setImageData(const Image& im, Format fmt, Orient orient,
+                  BitmapMode bitmapMode = BitmapMode::DDB);
+
+/// DIBs, and DIB section of CF_BITMAP, are written from src straight
+/// into their memory; DDB and PNG need the whole image, and pull it
+/// into memory first
+ClipData encodeRows(RowSource& src, Format fmt, Orient orient,
+                    BitmapMode bitmapMode = BitmapMode::DDB);
+
+/// Makes CF_BITMAP from premultiplied top-down packed pixels
+ClipData makeBitmapData(Dims dims, const void* premultiplied);
+
+/// Makes CF_BITMAP as top-down DIB section; writer fills its packed
+/// pixels in place, and they should be premultiplied
+ClipData makeDibSectionData(Dims dims, const std::function<void(char*)>& writer);
+
+///
+///  Spare global memory blocks. Once SetClipboardData succeeds, memory
+///  belongs to system and is freed by it, so only our own blocks that
+///  never got to clipboard come back here. Not thread-safe.
+///
+class GlobalPool
+{
+public:
+    explicit GlobalPool(size_t maxSpares = 2) : fMaxSpares(maxSpares) {}
+    ~GlobalPool();
+    GlobalPool(const GlobalPool&) = delete;
+    GlobalPool& operator = (const GlobalPool&) = delete;
+
+    /// Same as allocGlobal, but reuses a spare block if there is one
+    HGLOBAL alloc(size_t nBytes, const std::function<void(ByteWriter&)>& writer);
+    /// Allocates a spare block beforehand, out of hot path
+    void reserve(size_t nBytes);
+    /// Takes block back; frees it if pool is full
+    void recycle(HGLOBAL data);
+    size_t nSpares() const { return fSpares.size(); }
+private:
+    std::vector<HGLOBAL> fSpares;
+    size_t fMaxSpares;
+
+    /// @return  unlocked block of exactly nBytes
+    HGLOBAL take(size_t nBytes);
+};
+
+///
+///  Encoder for repeated publishing, e.g. live preview: keeps scratch
+///  buffers at their high-water mark, and global memory in a GlobalPool,
+///  so that steady-state copies do not hit the allocator for scratch.
+///  Keeps the last DIB too: when the same image comes again in the same
+///  format, only rows written since (see Image::rowVersion) are encoded;
+///  writes through Image::uncheckedAt need Image::markDirty.
+///  Not thread-safe, one per publishing thread.
+///
+class DibEncoder
+{
+public:
+    /// Encodes DIB into encoder’s buffer, valid until next call
+    std::span<const char> makeDib(const Image& im, Format fmt,
+                                  Orient orient = Orient::BOTTOM_UP);
+    /// Same as encodeImage. DIBs are patched in the last DIB and then
+    /// copied to global memory, as clipboard keeps the memory it got.
+    ClipData encode(const Image& im, Format fmt, Orient orient,
+                    BitmapMode bitmapMode = BitmapMode::DDB);
+    /// Frees the last DIB, next one is encoded in full
+    void forgetLast();
+    /// Puts data to clipboard; if clipboard refuses it, memory goes
+    /// back to pool
+    void publish(ClipData data);
+    /// Takes unpublished data back to pool
+    void recycle(ClipData data);
+    GlobalPool& pool() { return fPool; }
+private:
+    struct LastDib {
+        uint64_t imageId = 0;
+        /// Image version closed when encoding
+        uint64_t version = 0;
+        Format format = Format::DIB_OLD;
+        Orient orient = Orient::BOTTOM_UP;
+        ByteBuffer data;
+    };
+    std::vector<char, NoInitAllocator<char>> fScratch;
+    std::string fPng;
+    LastDib fLast;
+    GlobalPool fPool;
+
+    char* scratch(size_t nBytes);
+    /// Brings fLast up to im, re-encoding only what changed
+    void updateLast(const Image& im, Format fmt, Orient orient);
+};
+
+///
+///  Encoded payloads by image content, for the same image copied again
+///  and again: a small LRU per format, keyed by hashImage. Knows what it
+///  published last, too: if clipboard sequence number has not moved since,
+///  clipboard still has it and copyImageCached skips the copy altogether.
+///  DIBs and PNG are cached; CF_BITMAP is encoded anew (but skipped too).
+///  Not thread-safe.
+///
+class DibCache
+{
+public:
+    struct Key {
+        uint64_t hash = 0;
+        size_t width = 0, height = 0;
+        Format format = Format::DIB_OLD;
+        Orient orient = Orient::BOTTOM_UP;
+
+        bool operator == (const Key&) const = default;
+    };
+
+    explicit DibCache(size_t nPerFormat = 4) : fNPerFormat(nPerFormat) {}
+
+    /// Hashes im: always, as pixels can change where no stamp sees it
+    Key keyOf(const Image& im, Format fmt, Orient orient);
+    /// Same as encodeImage, with payloads from cache if they are there
+    ClipData encode(const Key& key, const Image& im, BitmapMode bitmapMode);
+    /// Remembers that key went to clipboard, as of current sequence number
+    void setPublished(const Key& key);
+    /// Clipboard has not changed since key was published
+    bool isPublished(const Key& key) const;
+    void clear();
+    size_t nHits() const { return fNHits; }
+    size_t nMisses() const { return fNMisses; }
+private:
+    struct Entry {
+        Key key;
+        ByteBuffer data;
+    };
+    size_t fNPerFormat;
+    /// Most recently used first
+    std::map<Format, std::vector<Entry>> fEntries;
+    std::optional<Key> fPublished;
+    DWORD fPublishedSequence = 0;
+    size_t fNHits = 0, fNMisses = 0;
+
+    /// Payload for key, encoded if needed
+    std::span<const char> payload(const Key& key, const Image& im);
+};
+
+/// Encodes foreign pixels, converting them in the same pass
+template <class Fmt>
+ClipData encodePixels(const PixelView<Fmt>& src, Format fmt, Orient orient,
+                      BitmapMode bitmapMode = BitmapMode::DDB)
+{
+    Dims dims(src.width, src.height);
+    fmt = publishedFormat(fmt, bitmapMode);
+    if (isDib(fmt)) {
+        return ClipData(nativeFormat(fmt), allocGlobal(dibSize(dims, fmt),
+                    [&src, fmt, orient](ByteWriter& w) { writeDib(w, src, fmt, orient); }));
+    }
+    if (fmt == Format::PNG)
+        return encodeImage(toImage(src), fmt, orient);
+    if (bitmapMode == BitmapMode::DIB_SECTION) {
+        return makeDibSectionData(dims, [&src](char* p) {
+                    writeImageData(p, src, Orient::TOP_DOWN, Alpha::PREMULTIPLIED); });
+    }
+    auto premul = std::make_unique_for_overwrite<char[]>(dims.nBytes());
+    writeImageData(premul.get(), src, Orient::TOP_DOWN, Alpha::PREMULTIPLIED);
+    return makeBitmapData(dims, premul.get());
+}
+
+
+///
+///  Hidden message-only window
+///
+class MessageWindow
+{
+public:
+    MessageWindow();
+    virtual ~MessageWindow();
+    MessageWindow(const MessageWindow&) = delete;
+    MessageWindow& operator = (const MessageWindow&) = delete;
+
+    HWND handle() const { return fHandle; }
+    /// Handles all messages in queue, does not wait
+    void processMessages();
+protected:
+    virtual LRESULT handleMessage(UINT msg, WPARAM wParam, LPARAM lParam);
+    /// Derived classes that handle messages sent during DestroyWindow
+    /// should call it from their destructors, while they are still alive
+    void destroy();
+private:
+    HWND fHandle = nullptr;
+    static LRESULT CALLBACK wndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+};
+
+
+///
+///  Clipboard owner for delayed rendering: keeps images and encodes them
+///  only when some consumer requests a format (WM_RENDERFORMAT), or when
+///  the owner goes away (WM_RENDERALLFORMATS).
+///  Consumers’ requests are served while the owner’s thread pumps messages.
+///
+class ClipboardOwner : public MessageWindow
+{
+public:
+    ~ClipboardOwner() override;
+    void addPending(std::shared_ptr<const Image> im, Format fmt, Orient orient,
+                    BitmapMode bitmapMode = BitmapMode::DDB);
+    /// Forgets image that was not published after all
+    void removePending(uint32_t nativeFormat) { fPending.erase(nativeFormat); }
+protected:
+    LRESULT handleMessage(UINT msg, WPARAM wParam, LPARAM lParam) override;
+private:
+    struct Pending {
+        std::shared_ptr<const Image> image;
+        Format format;
+        Orient orient;
+        BitmapMode bitmapMode;
+    };
+    std::map<uint32_t, Pending> fPending;
+
+    void render(uint32_t nativeFormat);
+    void renderAll();
+};
+
+
+///
+///  Clipboard change, as told to listeners
+///
+struct ClipboardChange {
+    /// GetClipboardSequenceNumber after change
+    DWORD sequence;
+    /// Clipboard owner belongs to this process, i.e. change is ours
+    bool isOurs;
+};
+
+/// @return  GetClipboardSequenceNumber; 0 if there is no access to it
+DWORD clipboardSequence();
+
+///
+///  Gets told of clipboard changes (AddClipboardFormatListener) instead of
+///  polling: onChange is called on WM_CLIPBOARDUPDATE, while the thread
+///  that made the listener pumps messages. Updates that do not change
+///  sequence number go unreported.
+///
+class ClipboardListener : public MessageWindow
+{
+public:
+    using OnChange = std::function<void(const ClipboardChange&)>;
+
+    explicit ClipboardListener(OnChange onChange);
+    ~ClipboardListener() override;
+    /// Sequence number of the last change reported
+    DWORD lastSequence() const { return fLastSequence; }
+protected:
+    LRESULT handleMessage(UINT msg, WPARAM wParam, LPARAM lParam) override;
+private:
+    OnChange fOnChange;
+    DWORD fLastSequence;
+};
+
+///
+///  ClipboardListener on a thread of its own that sleeps in GetMessage,
+///  for callers that pump no messages. onChange is called on that thread.
+///
+class ClipboardWatcher
+{
+public:
+    explicit ClipboardWatcher(ClipboardListener::OnChange onChange);
+    /// Waits until the callback in progress returns
+    ~ClipboardWatcher();
+    ClipboardWatcher(const ClipboardWatcher&) = delete;
+    ClipboardWatcher& operator = (const ClipboardWatcher&) = delete;
+private:
+    std::thread fThread;
+    DWORD fThreadId = 0;
+};
+
+///
+///  How Clipboard waits while another process (clipboard manager, RDP…)
+///  holds clipboard: tries again and again, first yielding, then sleeping
+///  for delays that double up to maxDelay
+///
+struct OpenPolicy {
+    unsigned maxAttempts = 12;
+    /// Attempts that only yield the rest of time slice
+    unsigned nSpins = 2;
+    std::chrono::milliseconds firstDelay { 1 };
+    std::chrono::milliseconds maxDelay { 50 };
+
+    /// Fail at once, as OpenClipboard itself
+    static constexpr OpenPolicy noWait() { return { .maxAttempts = 1, .nSpins = 0 }; }
+};
+
+///
+///  Clipboard contention counters, summed over all Clipboard objects
+///
+struct ContentionStats {
+    /// Successful opens
+    uint64_t nOpens = 0;
+    /// All OpenClipboard calls, successful or not
+    uint64_t nAttempts = 0;
+    /// Opens that did not succeed after all attempts
+    uint64_t nFailures = 0;
+    /// Total time spent waiting between attempts
+    std::chrono::microseconds waitTime { 0 };
+    /// Who held clipboard the last time we could not open it
+    HWND lastBlocker = nullptr;
+    DWORD lastBlockerPid = 0;
+};
+
+ContentionStats clipboardStats();
+void resetClipboardStats();
+
+
+///
+///  Big payloads go to temp files instead of global memory: the file is
+///  written through a mapping, and clipboard gets CF_HDROP with it.
+///  Images become .bmp files, other data .bin.
+///
+struct SpillPolicy {
+    /// Payloads of this size and more are spilled; 0 = never
+    size_t threshold = 0;
+    /// Empty = temp folder
+    std::wstring directory;
+
+    bool isSpilled(size_t nBytes) const { return threshold != 0 && nBytes >= threshold; }
+};
+
+/// Creates new file of nBytes in policy’s folder, lets writer fill it in
+/// place through mapping; file is remembered for removeSpillFiles
+/// @return  path of file
+std::wstring spillToFile(const SpillPolicy& policy, const wchar_t* extension,
+                         size_t nBytes, const std::function<void(ByteWriter&)>& writer);
+
+/// Removes files spilled by this process: call when clipboard no longer
+/// has them. Clipboard removes older ones when a new session spills, and
+/// the rest go at exit.
+void removeSpillFiles();
+
+/// Makes CF_HDROP listing paths
+ClipData makeDropData(std::span<const std::wstring> paths);
+
+///
+///  Image in clipboard memory, pixels as clipboard has them
+///
+struct ClipboardView
+{
+    /// nullptr when there is no image to view
+    const Image* image = nullptr;
+    /// CF_DIBV5 is premultiplied, CF_DIB straight
+    Alpha alpha = Alpha::STRAIGHT;
+
+    explicit operator bool() const { return image; }
+};
+
+class Clipboard
+{
+public:
+    Clipboard() : Clipboard(OpenPolicy{}) {}
+    explicit Clipboard(const OpenPolicy& policy);
+    /// Opens clipboard in delayed rendering mode, owner should outlive
+    /// any data it publishes
+    explicit Clipboard(ClipboardOwner& owner, const OpenPolicy& policy = {});
+    ~Clipboard();
+
+    /// How CF_BITMAP is published from now on, DDB by default
+    void setBitmapMode(BitmapMode mode) { fBitmapMode = mode; }
+    BitmapMode bitmapMode() const { return fBitmapMode; }
+    /// copyRaw, copyInPlace and copyImage (all but PNG) spill payloads
+    /// above threshold to file, published as CF_HDROP instead
+    void setSpillPolicy(SpillPolicy policy) { fSpillPolicy = std::move(policy); }
+
+    void copyRaw(uint32_t nativeFormat, std::string_view data);
+    /// Allocates exactly nBytes of global memory and lets writer fill it
+    /// in place, without intermediate buffers
+    void copyInPlace(uint32_t nativeFormat, size_t nBytes,
+                     const std::function<void(char*)>& writer);
+    void copyBitmap(const Image& im);
+    void copyImage(const Image& im, Format fmt, Orient orient = Orient::BOTTOM_UP);
+    /// In delayed rendering mode just promises fmt and keeps im until
+    /// someone requests it; otherwise same as above
+    void copyImage(std::shared_ptr<const Image> im, Format fmt,
+                   Orient orient = Orient::BOTTOM_UP);
+    /// Publishes one image in several formats, see encodeImageMulti
+    void copyImageMulti(const Image& im, std::span<const Format> fmts,
+                        Orient orient = Orient::BOTTOM_UP);
+    /// Publishes DIB with previews, see encodeWithPreviews
+    void copyImageWithPreviews(const Image& im, Format fmt, unsigned maxLevels,
+                               Orient orient = Orient::BOTTOM_UP);
+    /// Publishes data encoded beforehand, gives it away; if some of it
+    /// cannot be set, empties clipboard and throws
+    void copyEncoded(std::span<ClipData> datas);
+    /// Publishes pixels of another format, with no intermediate Image
+    template <class Fmt>
+    void copyPixels(const PixelView<Fmt>& src, Format fmt,
+                    Orient orient = Orient::BOTTOM_UP)
+    {
+        clearIf();
+        encodePixels(src, fmt, orient, fBitmapMode).setToClipboard();
+    }
+
+    /// Same as copyImage, with payload from cache; see also copyImageCached
+    void copyImage(DibCache& cache, const Image& im, Format fmt,
+                   Orient orient = Orient::BOTTOM_UP);
+    /// Same as copyImage, reusing encoder’s buffers
+    void copyImage(DibEncoder& encoder, const Image& im, Format fmt,
+                   Orient orient = Orient::BOTTOM_UP);
+    /// Publishes image pulled from src, see encodeRows
+    void copyRows(RowSource& src, Format fmt, Orient orient = Orient::BOTTOM_UP);
+
+    /// Reads CF_DIBV5 or CF_DIB into straight alpha image; empty image
+    /// if clipboard has neither
+    Image pasteImage();
+    /// Views CF_DIBV5 or CF_DIB without copying when it is top-down 32bpp
+    /// BGRA with alpha; empty view otherwise, use pasteImage then. Copies
+    /// default to BOTTOM_UP: only those made with Orient::TOP_DOWN (and
+    /// an alpha mask, so not DIB_OLD) can be viewed.
+    /// View belongs to this Clipboard: valid until it closes or copies
+    /// anything.
+    ClipboardView viewImage();
+private:
+    void clearIf();
+    void releaseViews();
+    bool needClear = true;
+    /// Locked clipboard memory, unlocked by Image’s deleter
+    std::vector<std::unique_ptr<const Image>> fViews;
+    ClipboardOwner* fOwner = nullptr;
+    BitmapMode fBitmapMode = BitmapMode::DDB;
+    SpillPolicy fSpillPolicy;
+
+    bool hasSpilled = false;
+
+    /// Writes payload to a file and publishes it as CF_HDROP
+    void spill(const wchar_t* extension, size_t nBytes,
+               const std::function<void(ByteWriter&)>& writer);
+};
+
+
+///
+///  System clipboard as ClipboardBackend: every copy and paste opens it
+///  for its own short while
+///
+class Win32Backend : public ClipboardBackend
+{
+public:
+    explicit Win32Backend(const OpenPolicy& policy = {},
+                          BitmapMode bitmapMode = BitmapMode::DDB)
+        : fPolicy(policy), fBitmapMode(bitmapMode) {}
+
+    using ClipboardBackend::copyImage;
+    void copyImage(std::shared_ptr<const Image> im, std::span<const Format> fmts,
+                   Orient orient = Orient::BOTTOM_UP) override;
+    std::shared_ptr<const Image> pasteImage() override;
+    uint64_t sequence() const override { return clipboardSequence(); }
+private:
+    OpenPolicy fPolicy;
+    BitmapMode fBitmapMode;
+};
+
+/// Publishes im through cache, unless clipboard still has what cache
+/// published last and that is im in fmt: then does not even open it
+/// @return  whether clipboard was written
+bool copyImageCached(DibCache& cache, const Image& im, Format fmt,
+                     Orient orient = Orient::BOTTOM_UP, const OpenPolicy& policy = {},
+                     BitmapMode bitmapMode = BitmapMode::DDB);
+
+/// Encodes im off-thread, then opens clipboard only for the short
+/// EmptyClipboard/SetClipboardData window
+/// Future from std::async: dropping it waits for the copy right away
+[[nodiscard]] std::future<void> copyImageAsync(
+        std::shared_ptr<const Image> im, std::vector<Format> fmts,
+        Orient orient = Orient::BOTTOM_UP, const OpenPolicy& policy = {},
+        BitmapMode bitmapMode = BitmapMode::DDB);
+
+/// Same, calls onDone with nullptr or error. Copies run in order on one
+/// worker thread, which finishes queued ones at exit.
+void copyImageAsync(
+        std::shared_ptr<const Image> im, std::vector<Format> fmts, Orient orient,
+        std::function<void(std::exception_ptr)> onDone, const OpenPolicy& policy = {},
+        BitmapMode bitmapMode = BitmapMode::DDB);
+
+
+///
+///  Stages several formats, encodes them in thread pool while clipboard
+///  is not held, then commits them in one go: open, empty, set every
+///  format, close. Consumers see either old contents or all the new ones.
+///  Staging the same clipboard format again replaces it.
+///  Not thread-safe.
+///
+class ClipboardTransaction
+{
+public:
+    explicit ClipboardTransaction(const OpenPolicy& policy = {}) : fPolicy(policy) {}
+
+    void addRaw(uint32_t nativeFormat, std::string data);
+    /// CF_UNICODETEXT; Windows synthesizes CF_TEXT and CF_OEMTEXT from it
+    void addText(std::wstring_view text);
+    /// Registered format, e.g. "HTML Format"
+    void addCustom(const wchar_t* formatName, std::string data);
+    /// Writer is called while encoding, on some pool thread
+    void addInPlace(uint32_t nativeFormat, size_t nBytes,
+                    std::function<void(char*)> writer);
+    void addImage(std::shared_ptr<const Image> im, Format fmt,
+                  Orient orient = Orient::BOTTOM_UP);
+    /// For images added from now on
+    void setBitmapMode(BitmapMode mode) { fBitmapMode = mode; }
+
+    /// Encodes what is not encoded yet, in parallel; needs no clipboard.
+    /// Items that split themselves (big images) are encoded one after
+    /// another on the calling thread, each with the whole pool.
+    void encode();
+    /// Encodes what remains and publishes everything, even if nothing is
+    /// staged (then it just empties clipboard). If some format cannot be
+    /// set, clipboard is left empty rather than half-written. Transaction
+    /// is empty afterwards, also if commit fails.
+    void commit();
+    size_t size() const { return fItems.size(); }
+    bool empty() const { return fItems.empty(); }
+private:
+    struct Item {
+        uint32_t nativeFormat;
+        std::function<ClipData()> encoder;
+        ClipData data;
+        /// Encoder runs in thread pool itself
+        bool splitsItself = false;
+    };
+    OpenPolicy fPolicy;
+    BitmapMode fBitmapMode = BitmapMode::DDB;
+    std::vector<Item> fItems;
+
+    void add(uint32_t nativeFormat, std::function<ClipData()> encoder,
+             bool splitsItself = false);
+    static void encodeItems(std::vector<Item>& items);
+};
@@ -0,0 +1,334 @@
+#include "dib.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#include "parallel.h"
+#include "premultiply.h"
+#include "trace.h"
+
+
+char* writeImageData(char* p, const Image& im, Orient orient, Alpha alpha)
+{
+    TRACE_SCOPE("writeImageData");
+    TRACE_COUNT("writeImageData.bytes", im.nBytes());
+    if (orient == Orient::TOP_DOWN && im.isContiguous()
+            && im.nBytes() < PARALLEL_ENCODE_BYTES) {
+        copyRow(p, { im.data(), im.area() }, alpha);
+        return p + im.nBytes();
+    }
+    auto rowBytes = im.width() * sizeof(Rgba);
+    auto h = im.height();
+    // Image row y goes to DIB row y or h − 1 − y
+    auto writeRows = [&](size_t y0, size_t y1) {
+        for (size_t y = y0; y < y1; ++y) {
+            size_t dibY = (orient == Orient::TOP_DOWN) ? y : h - 1 - y;
+            copyRow(p + dibY * rowBytes, im.uncheckedScanLine(y), alpha);
+        }
+    };
+    if (im.nBytes() >= PARALLEL_ENCODE_BYTES) {
+        // Every worker takes a block of rows, and its own slice of p
+        parallelFor(h, PARALLEL_MIN_ROWS, writeRows);
+    } else {
+        writeRows(0, h);
+    }
+    return p + im.nBytes();
+}
+
+template <class T>
+static inline char* writeHeader(char* p, const T& header)
+{
+    memcpy(p, &header, sizeof(header));
+    return p + sizeof(header);
+}
+
+char* writeOldDibHeader(char* p, Dims dims, Orient orient)
+{
+    TRACE_SCOPE("header");
+    return writeDibHeader<Format::DIB_OLD>(p, dims, orient);
+}
+
+void writeOldDib(char* p, const Image& im, Orient orient)
+{
+    writeImageData(writeOldDibHeader(p, im, orient), im, orient);
+}
+
+std::string makeOldDib(const Image& im, Orient orient)
+{
+    TRACE_SCOPE("makeOldDib");
+    std::string r(oldDibSize(im), '\0');
+    writeOldDib(r.data(), im, orient);
+    return r;
+}
+
+void throwTooBigForDib()
+{
+    throw std::logic_error("Image is too big for DIB, spilled BMP file too "
+                           "(4 GiB of pixels at most): copy it as Format::PNG");
+}
+
+size_t newDibSize(Dims dims, LongDib isLong)
+{
+    checkDibDims(dims);
+    return dims.nBytes() + (static_cast<bool>(isLong)
+            ? dibHeaderSize<Format::DIB_NEW_LONG>() : dibHeaderSize<Format::DIB_NEW_SHORT>());
+}
+
+char* writeNewDibHeader(char* p, Dims dims, LongDib isLong, Orient orient)
+{
+    TRACE_SCOPE("header");
+    // The only runtime choice left
+    if (static_cast<bool>(isLong))
+        return writeDibHeader<Format::DIB_NEW_LONG>(p, dims, orient);
+    return writeDibHeader<Format::DIB_NEW_SHORT>(p, dims, orient);
+}
+
+void writeNewDib(char* p, const Image& im, LongDib isLong,
+                 Orient orient, Alpha alpha)
+{
+    writeImageData(writeNewDibHeader(p, im, isLong, orient), im, orient, alpha);
+}
+
+std::string makeNewDib(const Image& im, LongDib isLong,
+                       Orient orient, Alpha alpha)
+{
+    TRACE_SCOPE("makeNewDib");
+    std::string r(newDibSize(im, isLong), '\0');
+    writeNewDib(r.data(), im, isLong, orient, alpha);
+    return r;
+}
+
+size_t dibSize(Dims dims, Format fmt)
+{
+    if (fmt == Format::DIB_OLD)
+        return oldDibSize(dims);
+    return newDibSize(dims, longDib(fmt));
+}
+
+char* writeDibHeader(char* p, Dims dims, Format fmt, Orient orient)
+{
+    if (fmt == Format::DIB_OLD)
+        return writeOldDibHeader(p, dims, orient);
+    return writeNewDibHeader(p, dims, longDib(fmt), orient);
+}
+
+void writeDib(char* p, const Image& im, Format fmt, Orient orient)
+{
+    writeImageData(writeDibHeader(p, im, fmt, orient), im, orient, formatAlpha(fmt));
+}
+
+size_t bmpFileSize(Dims dims, Format fmt)
+{
+    auto r = sizeof(BITMAPFILEHEADER) + dibSize(dims, bmpFormat(fmt));
+    if (r > std::numeric_limits<DWORD>::max())
+        throwTooBigForDib();
+    return r;
+}
+
+void writeBmpFile(char* p, const Image& im, Format fmt, Orient orient)
+{
+    auto fileBytes = bmpFileSize(im, fmt);
+    fmt = bmpFormat(fmt);
+    auto dibBytes = fileBytes - sizeof(BITMAPFILEHEADER);
+    BITMAPFILEHEADER header;
+    memset(&header, 0, sizeof(header));
+    header.bfType = 0x4D42;     // BM
+    header.bfSize = sizeof(header) + dibBytes;
+    header.bfOffBits = sizeof(header) + (dibBytes - im.nBytes());
+    p = writeHeader(p, header);
+    writeImageData(writeDibHeader(p, im, fmt, orient), im, orient, Alpha::STRAIGHT);
+}
+
+void writeImageData(ByteWriter& w, const Image& im, Orient orient, Alpha alpha)
+{
+    writeImageData(w.take(im.nBytes()), im, orient, alpha);
+}
+
+void writeDibHeader(ByteWriter& w, Dims dims, Format fmt, Orient orient)
+{
+    auto p = w.take(dibSize(dims, fmt) - dims.nBytes());
+    writeDibHeader(p, dims, fmt, orient);
+}
+
+void writeDib(ByteWriter& w, const Image& im, Format fmt, Orient orient)
+{
+    writeDib(w.take(dibSize(im, fmt)), im, fmt, orient);
+}
+
+void writeDib(ByteWriter& w, RowSource& src, Format fmt, Orient orient)
+{
+    writeDib(w.take(dibSize(Dims(src.width(), src.height()), fmt)), src, fmt, orient);
+}
+
+void writeBmpFile(ByteWriter& w, const Image& im, Format fmt, Orient orient)
+{
+    writeBmpFile(w.take(bmpFileSize(im, fmt)), im, fmt, orient);
+}
+
+char* writeImageData(char* p, RowSource& src, Orient orient, Alpha alpha)
+{
+    TRACE_SCOPE("writeImageData(RowSource)");
+    auto w = src.width(), h = src.height();
+    ptrdiff_t rowBytes = w * sizeof(Rgba);
+    auto band = std::max<size_t>(src.bandHeight(), 1);
+    for (size_t y0 = 0; y0 < h; y0 += band) {
+        auto n = std::min(band, h - y0);
+        // Bottom-up DIB goes backwards
+        auto stride = (orient == Orient::TOP_DOWN) ? rowBytes : -rowBytes;
+        auto dest = (orient == Orient::TOP_DOWN)
+                ? p + y0 * rowBytes : p + (h - 1 - y0) * rowBytes;
+        src.produceRows(y0, n, dest, stride);
+        if (alpha == Alpha::PREMULTIPLIED) {
+            for (size_t i = 0; i < n; ++i) {
+                auto row = reinterpret_cast<Rgba*>(dest + ptrdiff_t(i) * stride);
+                premultiplyCopy(row, row, w);
+            }
+        }
+    }
+    return p + h * rowBytes;
+}
+
+void writeDib(char* p, RowSource& src, Format fmt, Orient orient)
+{
+    auto q = writeDibHeader(p, Dims(src.width(), src.height()), fmt, orient);
+    writeImageData(q, src, orient, formatAlpha(fmt));
+}
+
+/// @return  shift of 8-bit mask, or throws
+static unsigned maskShift(uint32_t mask)
+{
+    if (!mask)
+        throw std::logic_error("Unsupported DIB masks");
+    auto shift = std::countr_zero(mask);
+    if ((mask >> shift) != 0xFF)
+        throw std::logic_error("Unsupported DIB masks");
+    return shift;
+}
+
+DibLayout parseDib(std::span<const char> dib)
+{
+    BITMAPINFOHEADER header;
+    if (dib.size() < sizeof(header))
+        throw std::logic_error("DIB is too short");
+    memcpy(&header, dib.data(), sizeof(header));
+    if (header.biSize < sizeof(header) || header.biSize > dib.size()
+            || header.biWidth <= 0 || header.biHeight == 0 || header.biPlanes != 1)
+        throw std::logic_error("Broken DIB header");
+
+    DibLayout r;
+    r.width = header.biWidth;
+    if (header.biHeight < 0) {
+        r.height = -static_cast<int64_t>(header.biHeight);
+        r.orient = Orient::TOP_DOWN;
+    } else {
+        r.height = header.biHeight;
+    }
+    r.bitCount = header.biBitCount;
+    r.pixelOffset = header.biSize;
+
+    switch (header.biCompression) {
+    case BI_RGB:
+        if (r.bitCount != 32 && r.bitCount != 24)
+            throw std::logic_error("Unsupported DIB bit count");
+        r.rMask = Rgba::R_MASK;
+        r.gMask = Rgba::G_MASK;
+        r.bMask = Rgba::B_MASK;
+        break;
+    case BI_BITFIELDS: {
+            if (r.bitCount != 32)
+                throw std::logic_error("Unsupported DIB bit count");
+            // Masks are in longer headers, for old one they follow it
+            std::array<uint32_t, 4> masks {};
+            size_t maskOffset = sizeof(header);
+            size_t nMasks = (header.biSize >= sizeof(header) + 16) ? 4 : 3;
+            if (header.biSize == sizeof(header))
+                r.pixelOffset += BIT_PALETTE_SIZE;
+            if (maskOffset + nMasks * sizeof(uint32_t) > dib.size())
+                throw std::logic_error("DIB is too short");
+            memcpy(masks.data(), dib.data() + maskOffset, nMasks * sizeof(uint32_t));
+            r.rMask = masks[0];
+            r.gMask = masks[1];
+            r.bMask = masks[2];
+            r.aMask = masks[3];
+            maskShift(r.rMask);
+            maskShift(r.gMask);
+            maskShift(r.bMask);
+            if (r.aMask)
+                maskShift(r.aMask);
+        } break;
+    default:
+        throw std::logic_error("Unsupported DIB compression");
+    }
+    // Colour table, allowed but unused for 24/32bpp
+    r.pixelOffset += size_t(header.biClrUsed) * sizeof(RGBQUAD);
+
+    r.rowBytes = (r.width * r.bitCount / 8 + 3) & ~size_t(3);
+    auto fits = [&](size_t offset) {
+        return offset <= dib.size() && (dib.size() - offset) / r.rowBytes >= r.height;
+    };
+    auto fitsExactly = [&](size_t offset) {
+        return offset <= dib.size() && (dib.size() - offset) % r.rowBytes == 0
+                && (dib.size() - offset) / r.rowBytes == r.height;
+    };
+    // Long new DIB (LongDib::YES) repeats masks after header as old one does;
+    // nothing in header tells that, only size: exactly with them is long.
+    // Pixels are not looked at, and memory with slack reads as short.
+    if (header.biCompression == BI_BITFIELDS && header.biSize > sizeof(header)
+            && fitsExactly(r.pixelOffset + BIT_PALETTE_SIZE))
+        r.pixelOffset += BIT_PALETTE_SIZE;
+    if (!fits(r.pixelOffset))
+        throw std::logic_error("DIB is too short");
+    return r;
+}
+
+Image decodeDib(std::span<const char> dib, const DibLayout& layout, Alpha alpha)
+{
+    Image im(layout.width, layout.height, NO_INIT);
+    auto pixels = dib.data() + layout.pixelOffset;
+    // Opaque unless DIB says otherwise
+    bool forceOpaque = (layout.aMask == 0);
+    unsigned rShift = 0, gShift = 0, bShift = 0, aShift = 0;
+    if (layout.bitCount == 32 && !layout.isRgba()) {
+        rShift = maskShift(layout.rMask);
+        gShift = maskShift(layout.gMask);
+        bShift = maskShift(layout.bMask);
+        if (!forceOpaque)
+            aShift = maskShift(layout.aMask);
+    }
+
+    for (size_t y = 0; y < layout.height; ++y) {
+        size_t dibY = (layout.orient == Orient::TOP_DOWN) ? y : layout.height - 1 - y;
+        auto src = pixels + dibY * layout.rowBytes;
+        auto dest = im.uncheckedScanLine(y);
+        if (layout.bitCount == 24) {
+            auto p = reinterpret_cast<const unsigned char*>(src);
+            for (auto& px : dest) {
+                px = Rgba { .b = p[0], .g = p[1], .r = p[2] };
+                p += 3;
+            }
+        } else if (layout.isRgba()) {
+            // Fast path, our own layout
+            memcpy(dest.data(), src, spanBytes(dest));
+            if (forceOpaque)
+                for (auto& px : dest)
+                    px.a = 0xFF;
+        } else {
+            for (auto& px : dest) {
+                uint32_t v;
+                memcpy(&v, src, sizeof(v));
+                src += sizeof(v);
+                px = Rgba { .b = static_cast<unsigned char>(v >> bShift),
+                            .g = static_cast<unsigned char>(v >> gShift),
+                            .r = static_cast<unsigned char>(v >> rShift),
+                            .a = forceOpaque ? static_cast<unsigned char>(0xFF)
+                                             : static_cast<unsigned char>(v >> aShift) };
+            }
+        }
+        if (alpha == Alpha::PREMULTIPLIED && !forceOpaque)
+            unpremultiply(dest.data(), dest.size());
+    }
+    return im;
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "dibstructs.h"
+
+#include "bytewriter.h"
+#include "image.h"
+#include "pixelformat.h"
+#include "premultiply.h"
+#include "rowsource.h"
+
+// Check for header assumptions
+static_assert(sizeof(BITMAPINFOHEADER) == 0x28);
+static_assert(sizeof(BITMAPV5HEADER) == 0x7C);
+static_assert(sizeof(BITMAPFILEHEADER) == 14);
+
+/// Bitfield masks that follow BI_BITFIELDS headers
+constexpr std::array<uint32_t, 3> BIT_PALETTE { Rgba::R_MASK, Rgba::G_MASK, Rgba::B_MASK };
+constexpr size_t BIT_PALETTE_SIZE = sizeof(BIT_PALETTE);
+
+/// Images of this size and more are encoded in thread pool
+constexpr size_t PARALLEL_ENCODE_BYTES = 50 << 20;
+/// Not fewer rows per block, to keep per-block overhead small
+constexpr size_t PARALLEL_MIN_ROWS = 16;
+
+template <class T>
+inline size_t spanBytes(const std::span<T>& data)
+    { return sizeof(T) * data.size(); }
+
+/// How DIB stores alpha
+enum class Alpha : bool { STRAIGHT, PREMULTIPLIED };
+
+/// Row order of DIB. Bottom-up is classic, top-down (negative height)
+/// is understood by most modern consumers and is written in one copy.
+enum class Orient : bool { BOTTOM_UP, TOP_DOWN };
+
+enum class LongDib : bool { NO, YES };
+
+/// PNG is registered format "PNG", understood by browsers, Office
+/// and most image editors; much smaller than DIB for screen content
+enum class Format { DIB_OLD, DIB_NEW_SHORT, DIB_NEW_LONG, BITMAP, PNG };
+
+inline bool isDib(Format fmt)
+    { return (fmt != Format::BITMAP && fmt != Format::PNG); }
+
+inline LongDib longDib(Format fmt)
+    { return (fmt == Format::DIB_NEW_LONG) ? LongDib::YES : LongDib::NO; }
+
+/// CF_DIB has no alpha channel in its format and PNG is straight by spec,
+/// others are premultiplied as CF_DIBV5 and CF_BITMAP (AlphaBlend)
+/// consumers expect
+inline Alpha formatAlpha(Format fmt)
+{
+    return (fmt == Format::DIB_OLD || fmt == Format::PNG)
+            ? Alpha::STRAIGHT : Alpha::PREMULTIPLIED;
+}
+
+/// Size of 32bpp DIB image
+struct Dims {
+    size_t width = 0, height = 0;
+
+    Dims() = default;
+    Dims(size_t aWidth, size_t aHeight) : width(aWidth), height(aHeight) {}
+    Dims(const Image& im) : width(im.width()), height(im.height()) {}
+    size_t nBytes() const { return width * height * sizeof(Rgba); }
+};
+
+[[noreturn]] void throwTooBigForDib();
+
+/// Throws unless DIB header can hold dims: sides are LONG, and size of
+/// pixels is DWORD. Sizes below check it, before anything is allocated.
+/// Spilling does not help, BMP file has the same limit: bigger images,
+/// e.g. 32K×32K, go as Format::PNG.
+inline void checkDibDims(Dims dims)
+{
+    constexpr size_t MAX_SIDE = std::numeric_limits<LONG>::max();
+    if (dims.width > MAX_SIDE || dims.height > MAX_SIDE
+            || dims.nBytes() > std::numeric_limits<DWORD>::max()) [[unlikely]]
+        throwTooBigForDib();
+}
+
+inline LONG dibHeight(Dims dims, Orient orient)
+{
+    LONG r = dims.height;
+    return (orient == Orient::TOP_DOWN) ? -r : r;
+}
+
+/// Copies a row, converting alpha on the way
+inline void copyRow(char* p, std::span<const Rgba> row, Alpha alpha)
+{
+    if (alpha == Alpha::PREMULTIPLIED) {
+        premultiplyCopy(reinterpret_cast<Rgba*>(p), row.data(), row.size());
+    } else {
+        memcpy(p, row.data(), spanBytes(row));
+    }
+}
+
+///
+///  Header prototypes, everything filled in at compile time but size:
+///  writing a header is then a fixed-size copy and three stores
+///
+template <Format fmt> struct DibPrototype;
+
+template <>
+struct DibPrototype<Format::DIB_OLD> {
+    using Header = BITMAPINFOHEADER;
+    static constexpr bool HAS_PALETTE = true;
+    static constexpr Header HEADER = [] {
+        Header r {};
+        r.biSize = sizeof(Header);
+        r.biPlanes = 1;
+        r.biBitCount = 32;
+        r.biCompression = BI_BITFIELDS;
+        return r;
+    }();
+};
+
+template <LongDib isLong>
+struct NewDibPrototype {
+    using Header = BITMAPV5HEADER;
+    static constexpr bool HAS_PALETTE = static_cast<bool>(isLong);
+    static constexpr Header HEADER = [] {
+        Header r {};
+        r.bV5Size = sizeof(Header);
+        r.bV5Planes = 1;
+        r.bV5BitCount = 32;
+        r.bV5Compression = BI_BITFIELDS;
+        r.bV5RedMask = Rgba::R_MASK;
+        r.bV5GreenMask = Rgba::G_MASK;
+        r.bV5BlueMask = Rgba::B_MASK;
+        r.bV5AlphaMask = Rgba::A_MASK;
+        r.bV5CSType = LCS_sRGB;
+        r.bV5Intent = LCS_GM_IMAGES;
+        return r;
+    }();
+};
+
+template <>
+struct DibPrototype<Format::DIB_NEW_SHORT> : NewDibPrototype<LongDib::NO> {};
+template <>
+struct DibPrototype<Format::DIB_NEW_LONG> : NewDibPrototype<LongDib::YES> {};
+
+inline void setDibSize(BITMAPINFOHEADER& header, Dims dims, Orient orient)
+{
+    checkDibDims(dims);
+    header.biWidth = dims.width;
+    header.biHeight = dibHeight(dims, orient);
+    header.biSizeImage = dims.nBytes();
+}
+
+inline void setDibSize(BITMAPV5HEADER& header, Dims dims, Orient orient)
+{
+    checkDibDims(dims);
+    header.bV5Width = dims.width;
+    header.bV5Height = dibHeight(dims, orient);
+    header.bV5SizeImage = dims.nBytes();
+}
+
+/// @return  bytes before pixels in DIB of format fmt
+template <Format fmt>
+constexpr size_t dibHeaderSize()
+{
+    using Proto = DibPrototype<fmt>;
+    return sizeof(typename Proto::Header) + (Proto::HAS_PALETTE ? BIT_PALETTE_SIZE : 0);
+}
+
+static_assert(dibHeaderSize<Format::DIB_OLD>() == 0x28 + BIT_PALETTE_SIZE);
+static_assert(dibHeaderSize<Format::DIB_NEW_LONG>() == 0x7C + BIT_PALETTE_SIZE);
+
+/// Writes header of format fmt known at compile time, and its palette
+/// @return  pointer to image data
+template <Format fmt>
+inline char* writeDibHeader(char* p, Dims dims, Orient orient)
+{
+    using Proto = DibPrototype<fmt>;
+    auto header = Proto::HEADER;
+    setDibSize(header, dims, orient);
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    if constexpr (Proto::HAS_PALETTE) {
+        memcpy(p, BIT_PALETTE.data(), BIT_PALETTE_SIZE);
+        p += BIT_PALETTE_SIZE;
+    }
+    return p;
+}
+
+/// Writes packed pixels of im in DIB row order;
+/// big images are split between threads by row blocks
+/// @return  pointer past them
+char* writeImageData(char* p, const Image& im, Orient orient = Orient::BOTTOM_UP,
+                     Alpha alpha = Alpha::STRAIGHT);
+
+/// @return  exact size of DIB that writeOldDib produces
+inline size_t oldDibSize(Dims dims)
+    { checkDibDims(dims); return dibHeaderSize<Format::DIB_OLD>() + dims.nBytes(); }
+
+/// Writes old DIB header and palette
+/// @return  pointer to image data
+char* writeOldDibHeader(char* p, Dims dims, Orient orient);
+
+/// Writes old DIB to p, which should hold at least oldDibSize(im) bytes
+void writeOldDib(char* p, const Image& im, Orient orient = Orient::BOTTOM_UP);
+
+std::string makeOldDib(const Image& im, Orient orient = Orient::BOTTOM_UP);
+
+/// @return  exact size of DIB that writeNewDib produces
+size_t newDibSize(Dims dims, LongDib isLong);
+
+/// Writes new DIB header and optional palette
+/// @return  pointer to image data
+char* writeNewDibHeader(char* p, Dims dims, LongDib isLong, Orient orient);
+
+/// Writes new DIB to p, which should hold at least newDibSize(im, isLong) bytes
+void writeNewDib(char* p, const Image& im, LongDib isLong,
+                 Orient orient = Orient::BOTTOM_UP,
+                 Alpha alpha = Alpha::PREMULTIPLIED);
+
+std::string makeNewDib(const Image& im, LongDib isLong,
+                       Orient orient = Orient::BOTTOM_UP,
+                       Alpha alpha = Alpha::PREMULTIPLIED);
+
+/// @return  exact size of DIB of format fmt
+size_t dibSize(Dims dims, Format fmt);
+
+/// Writes DIB header of format fmt, and palette if it has one
+/// @return  pointer to image data
+char* writeDibHeader(char* p, Dims dims, Format fmt, Orient orient);
+
+/// Writes DIB of format fmt
+void writeDib(char* p, const Image& im, Format fmt, Orient orient);
+
+/// .bmp files have DIB formats only, others are written as V5
+inline Format bmpFormat(Format fmt)
+    { return isDib(fmt) ? fmt : Format::DIB_NEW_SHORT; }
+
+/// @return  exact size of .bmp file that writeBmpFile produces;
+/// throws if it does not fit bfSize
+size_t bmpFileSize(Dims dims, Format fmt);
+
+/// Writes .bmp file: file header and DIB of bmpFormat(fmt), with
+/// straight alpha as image files have it
+void writeBmpFile(char* p, const Image& im, Format fmt, Orient orient);
+
+/// Writes DIB of format fmt known at compile time
+template <Format fmt>
+void writeDib(char* p, const Image& im, Orient orient)
+{
+    writeImageData(writeDibHeader<fmt>(p, im, orient), im, orient, formatAlpha(fmt));
+}
+
+/// Makes DIB of format fmt known at compile time, e.g. for bursts of
+/// small thumbnails, where header matters
+template <Format fmt>
+std::string makeDib(const Image& im, Orient orient = Orient::BOTTOM_UP)
+{
+    std::string r(dibHeaderSize<fmt>() + im.nBytes(), '\0');
+    writeDib<fmt>(r.data(), im, orient);
+    return r;
+}
+
+///
+///  Same writers over ByteWriter, which all backends give. They take
+///  exactly as many bytes as sizes above say.
+///
+void writeImageData(ByteWriter& w, const Image& im, Orient orient, Alpha alpha);
+void writeDibHeader(ByteWriter& w, Dims dims, Format fmt, Orient orient);
+void writeDib(ByteWriter& w, const Image& im, Format fmt, Orient orient);
+void writeDib(ByteWriter& w, RowSource& src, Format fmt, Orient orient);
+void writeBmpFile(ByteWriter& w, const Image& im, Format fmt, Orient orient);
+
+/// Pulls rows from src band by band, right to their place in DIB:
+/// no full-size buffer besides p itself
+/// @return  pointer past pixels
+char* writeImageData(char* p, RowSource& src, Orient orient, Alpha alpha);
+
+void writeDib(char* p, RowSource& src, Format fmt, Orient orient);
+
+///
+///  Layout of a DIB someone gave us
+///
+struct DibLayout {
+    size_t width = 0, height = 0;
+    Orient orient = Orient::BOTTOM_UP;
+    unsigned bitCount = 0;
+    /// Masks of 32-bit pixels; BI_RGB has no alpha mask
+    uint32_t rMask = 0, gMask = 0, bMask = 0, aMask = 0;
+    /// From start of DIB
+    size_t pixelOffset = 0;
+    /// DIB rows are padded to 4 bytes
+    size_t rowBytes = 0;
+
+    /// Pixels are in Rgba layout
+    bool isRgba() const
+        { return bitCount == 32 && rMask == Rgba::R_MASK && gMask == Rgba::G_MASK
+                 && bMask == Rgba::B_MASK; }
+    /// Pixels are Rgba with alpha, and rows go exactly like Image’s:
+    /// TOP_DOWN only, while our writers default to BOTTOM_UP
+    bool isImageLayout() const
+        { return isRgba() && aMask == Rgba::A_MASK && orient == Orient::TOP_DOWN; }
+};
+
+/// Parses header of 32bpp (BI_RGB or BI_BITFIELDS with 8-bit masks) or
+/// 24bpp DIB; throws when DIB is broken or unsupported. Layout comes from
+/// header and size alone: long new DIB is told by its exact size.
+DibLayout parseDib(std::span<const char> dib);
+
+/// Converts DIB to packed image with straight alpha, like every Image;
+/// alpha says how DIB has it (formatAlpha: CF_DIBV5 is premultiplied).
+/// BI_RGB is opaque.
+Image decodeDib(std::span<const char> dib, const DibLayout& layout, Alpha alpha);
+
+
+///
+///  Writers of foreign pixel formats: convert to Rgba while serializing,
+///  one row at a time, straight into the destination
+///
+
+template <class Fmt>
+char* writeImageData(char* p, const PixelView<Fmt>& src, Orient orient, Alpha alpha)
+{
+    auto rowBytes = src.width * sizeof(Rgba);
+    for (size_t y = 0; y < src.height; ++y) {
+        size_t dibY = (orient == Orient::TOP_DOWN) ? y : src.height - 1 - y;
+        auto dest = reinterpret_cast<Rgba*>(p + dibY * rowBytes);
+        convertToRgba<Fmt>(src.row(y), dest, src.width);
+        // Row is still in cache
+        if (alpha == Alpha::PREMULTIPLIED)
+            premultiplyCopy(dest, dest, src.width);
+    }
+    return p + src.height * rowBytes;
+}
+
+template <class Fmt>
+void writeDib(char* p, const PixelView<Fmt>& src, Format fmt, Orient orient)
+{
+    writeImageData(writeDibHeader(p, Dims(src.width, src.height), fmt, orient), src, orient, formatAlpha(fmt));
+}
+
+template <class Fmt>
+void writeDib(ByteWriter& w, const PixelView<Fmt>& src, Format fmt, Orient orient)
+{
+    writeDib(w.take(dibSize(Dims(src.width, src.height), fmt)), src, fmt, orient);
+}
+
+template <class Fmt>
+std::string makeOldDib(const PixelView<Fmt>& src, Orient orient = Orient::BOTTOM_UP)
+{
+    std::string r(oldDibSize(Dims(src.width, src.height)), '\0');
+    writeDib(r.data(), src, Format::DIB_OLD, orient);
+    return r;
+}
+
+template <class Fmt>
+std::string makeNewDib(const PixelView<Fmt>& src, LongDib isLong,
+                       Orient orient = Orient::BOTTOM_UP,
+                       Alpha alpha = Alpha::PREMULTIPLIED)
+{
+    std::string r(newDibSize(Dims(src.width, src.height), isLong), '\0');
+    auto p = writeNewDibHeader(r.data(), Dims(src.width, src.height), isLong, orient);
+    writeImageData(p, src, orient, alpha);
+    return r;
+}
@@ -0,0 +1,174 @@
+#include "draw.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define DRAW_X86 1
+    #include <emmintrin.h>
+#endif
+
+
+namespace {
+
+    enum class Stream : bool { NO, YES };
+
+    Stream streamFor(size_t nBytes)
+        { return (nBytes >= STREAM_DRAW_BYTES) ? Stream::YES : Stream::NO; }
+
+#if DRAW_X86
+
+    /// Adopted pixels may sit at any address (alignof(Rgba) is 1); only
+    /// whole pixels can reach 16-byte alignment for streaming stores
+    bool canStream(const Rgba* p, Stream stream)
+        { return stream == Stream::YES && reinterpret_cast<uintptr_t>(p) % sizeof(Rgba) == 0; }
+
+    /// Pixels before p gets 16-byte aligned; p must be 4-byte aligned
+    size_t headPixels(const Rgba* p, size_t n)
+        { return std::min(n, ((0 - reinterpret_cast<uintptr_t>(p)) & 15) / sizeof(Rgba)); }
+
+    void fillSpan(Rgba* p, size_t n, Rgba color, Stream stream)
+    {
+        if (!canStream(p, stream)) {
+            std::fill_n(p, n, color);
+            return;
+        }
+        size_t head = headPixels(p, n);
+        std::fill_n(p, head, color);
+        const __m128i v = _mm_set1_epi32(std::bit_cast<int>(color));
+        size_t i = head;
+        for (; i + 4 <= n; i += 4)
+            _mm_stream_si128(reinterpret_cast<__m128i*>(p + i), v);
+        std::fill_n(p + i, n - i, color);
+    }
+
+    void copySpan(Rgba* dest, const Rgba* src, size_t n, Stream stream)
+    {
+        if (!canStream(dest, stream)) {
+            memcpy(dest, src, n * sizeof(Rgba));
+            return;
+        }
+        size_t head = headPixels(dest, n);
+        memcpy(dest, src, head * sizeof(Rgba));
+        size_t i = head;
+        for (; i + 4 <= n; i += 4) {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dest + i),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        }
+        memcpy(dest + i, src + i, (n - i) * sizeof(Rgba));
+    }
+
+    /// Streaming stores are weakly ordered: make them visible before
+    /// thread says it is done
+    void streamFence(Stream stream)
+        { if (stream == Stream::YES) _mm_sfence(); }
+
+#else
+
+    // Compilers do well with plain loops; no portable streaming stores
+    void fillSpan(Rgba* p, size_t n, Rgba color, Stream)
+        { std::fill_n(p, n, color); }
+    void copySpan(Rgba* dest, const Rgba* src, size_t n, Stream)
+        { memcpy(dest, src, n * sizeof(Rgba)); }
+    void streamFence(Stream) {}
+
+#endif
+
+    /// Runs body(y0, y1) over nRows rows of rowBytes each, in parallel
+    /// if they are big enough
+    template <class Body>
+    void forRows(size_t nRows, size_t rowBytes, Body&& body)
+    {
+        if (nRows * rowBytes >= PARALLEL_DRAW_BYTES && nRows > 1) {
+            parallelFor(nRows, std::max<size_t>(1, (PARALLEL_DRAW_BYTES / 4) / rowBytes), body);
+        } else {
+            body(0, nRows);
+        }
+    }
+
+    /// rect clipped to im
+    Rect clip(const Image& im, const Rect& rect)
+    {
+        Rect r = rect;
+        r.x = std::min(r.x, im.width());
+        r.y = std::min(r.y, im.height());
+        r.width = std::min(r.width, im.width() - r.x);
+        r.height = std::min(r.height, im.height() - r.y);
+        return r;
+    }
+
+}   // anon namespace
+
+
+void fillPixels(Rgba* p, size_t n, Rgba color)
+{
+    auto stream = streamFor(n * sizeof(Rgba));
+    if (n * sizeof(Rgba) < PARALLEL_DRAW_BYTES) {
+        fillSpan(p, n, color, stream);
+        return;
+    }
+    // IMAGE_ALIGN-sized pieces, so that threads never share a cache line
+    constexpr size_t PIECE = IMAGE_ALIGN / sizeof(Rgba);
+    size_t nPieces = (n + PIECE - 1) / PIECE;
+    parallelFor(nPieces, PARALLEL_DRAW_BYTES / 4 / IMAGE_ALIGN, [&](size_t i0, size_t i1) {
+        size_t end = std::min(i1 * PIECE, n);
+        fillSpan(p + i0 * PIECE, end - i0 * PIECE, color, stream);
+        streamFence(stream);
+    });
+}
+
+
+void fill(Image& im, Rgba color)
+{
+    fillRect(im, Rect { .width = im.width(), .height = im.height() }, color);
+}
+
+
+void fillRect(Image& im, const Rect& rect, Rgba color)
+{
+    auto r = clip(im, rect);
+    if (r.width == 0 || r.height == 0)
+        return;
+    size_t rowBytes = r.width * sizeof(Rgba);
+    auto stream = streamFor(rowBytes * r.height);
+    forRows(r.height, rowBytes, [&](size_t y0, size_t y1) {
+        for (size_t y = r.y + y0; y < r.y + y1; ++y)
+            fillSpan(im.uncheckedScanLine(y).data() + r.x, r.width, color, stream);
+        streamFence(stream);
+    });
+}
+
+
+void fillRowSpan(Image& im, size_t y, size_t x0, size_t x1, Rgba color)
+{
+    if (x0 < x1)
+        fillRect(im, Rect { .x = x0, .y = y, .width = x1 - x0, .height = 1 }, color);
+}
+
+
+void blit(Image& dest, size_t x, size_t y, const Image& src, const Rect& srcRect)
+{
+    auto r = clip(src, srcRect);
+    auto destRect = clip(dest, Rect { .x = x, .y = y, .width = r.width, .height = r.height });
+    if (destRect.width == 0 || destRect.height == 0)
+        return;
+    if (&src == &dest) {
+        // Overlap: through a copy, simpler than choosing directions
+        Image tmp(destRect.width, destRect.height, NO_INIT);
+        blit(tmp, 0, 0, src, Rect { .x = r.x, .y = r.y,
+                                    .width = destRect.width, .height = destRect.height });
+        blit(dest, x, y, tmp);
+        return;
+    }
+    size_t rowBytes = destRect.width * sizeof(Rgba);
+    auto stream = streamFor(rowBytes * destRect.height);
+    forRows(destRect.height, rowBytes, [&](size_t y0, size_t y1) {
+        for (size_t i = y0; i < y1; ++i) {
+            copySpan(dest.uncheckedScanLine(destRect.y + i).data() + destRect.x,
+                     src.uncheckedScanLine(r.y + i).data() + r.x, destRect.width, stream);
+        }
+        streamFence(stream);
+    });
+}
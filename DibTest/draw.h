@@ -0,0 +1,40 @@
+#pragma once
+
+#include "image.h"
+
+///
+///  Fill and copy primitives for generating frames. Big writes are split
+///  between threads of the pool, and those bigger than cache go with
+///  non-temporal stores, not to evict what whoever runs next needs.
+///  Everything is clipped to the image; rows written are stamped.
+///
+
+/// Writes of this many bytes and more go to thread pool
+constexpr size_t PARALLEL_DRAW_BYTES = 4 << 20;
+/// Writes of this many bytes and more bypass cache
+constexpr size_t STREAM_DRAW_BYTES = 32 << 20;
+
+struct Rect {
+    size_t x = 0, y = 0, width = 0, height = 0;
+};
+
+/// Fills n pixels of raw buffer, e.g. one being constructed
+void fillPixels(Rgba* p, size_t n, Rgba color);
+
+void fill(Image& im, Rgba color);
+void fillRect(Image& im, const Rect& rect, Rgba color);
+/// Pixels [x0, x1) of row y
+void fillRowSpan(Image& im, size_t y, size_t x0, size_t x1, Rgba color);
+
+/// Pixels [x0, x1) of row y
+inline void hline(Image& im, size_t y, size_t x0, size_t x1, Rgba color)
+    { fillRowSpan(im, y, x0, x1, color); }
+/// Pixels [y0, y1) of column x
+inline void vline(Image& im, size_t x, size_t y0, size_t y1, Rgba color)
+    { if (y0 < y1) fillRect(im, Rect { .x = x, .y = y0, .width = 1, .height = y1 - y0 }, color); }
+
+/// Copies srcRect of src to dest, with top left corner at (x, y).
+/// src may be dest, even with overlapping rects.
+void blit(Image& dest, size_t x, size_t y, const Image& src, const Rect& srcRect);
+inline void blit(Image& dest, size_t x, size_t y, const Image& src)
+    { blit(dest, x, y, src, Rect { .width = src.width(), .height = src.height() }); }
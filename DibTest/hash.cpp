@@ -0,0 +1,141 @@
+#include "hash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <vector>
+
+#include "parallel.h"
+
+
+namespace {
+
+    constexpr uint64_t P1 = 0x9E3779B185EBCA87;
+    constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4F;
+    constexpr uint64_t P3 = 0x165667B19E3779F9;
+    constexpr uint64_t P4 = 0x85EBCA77C2B2AE63;
+    constexpr uint64_t P5 = 0x27D4EB2F165667C5;
+
+    /// memcpy is what compilers turn into plain unaligned load
+    inline uint64_t read64(const unsigned char* p)
+        { uint64_t r; memcpy(&r, p, sizeof(r)); return r; }
+    inline uint32_t read32(const unsigned char* p)
+        { uint32_t r; memcpy(&r, p, sizeof(r)); return r; }
+
+    inline uint64_t round(uint64_t acc, uint64_t input)
+        { return std::rotl(acc + input * P2, 31) * P1; }
+
+    inline uint64_t mergeRound(uint64_t acc, uint64_t lane)
+        { return (acc ^ round(0, lane)) * P1 + P4; }
+
+    /// Strips of about this size are hashed separately
+    constexpr size_t STRIP_BYTES = 1 << 20;
+    /// Images of this size and more are hashed in thread pool
+    constexpr size_t PARALLEL_HASH_BYTES = 4 * STRIP_BYTES;
+
+}   // anon namespace
+
+
+Hasher64::Hasher64(uint64_t seed)
+    : fLanes { seed + P1 + P2, seed + P2, seed, seed - P1 }, fSeed(seed) {}
+
+
+void Hasher64::update(const void* data, size_t nBytes)
+{
+    auto p = static_cast<const unsigned char*>(data);
+    auto end = p + nBytes;
+    fTotal += nBytes;
+    if (fBuffered + nBytes < STRIPE) {
+        memcpy(fBuffer + fBuffered, p, nBytes);
+        fBuffered += nBytes;
+        return;
+    }
+    if (fBuffered != 0) {
+        size_t n = STRIPE - fBuffered;
+        memcpy(fBuffer + fBuffered, p, n);
+        p += n;
+        for (int i = 0; i < 4; ++i)
+            fLanes[i] = round(fLanes[i], read64(fBuffer + 8 * i));
+        fBuffered = 0;
+    }
+    // Lanes in locals, so that they stay in registers
+    uint64_t v0 = fLanes[0], v1 = fLanes[1], v2 = fLanes[2], v3 = fLanes[3];
+    for (; end - p >= static_cast<ptrdiff_t>(STRIPE); p += STRIPE) {
+        v0 = round(v0, read64(p));
+        v1 = round(v1, read64(p + 8));
+        v2 = round(v2, read64(p + 16));
+        v3 = round(v3, read64(p + 24));
+    }
+    fLanes[0] = v0; fLanes[1] = v1; fLanes[2] = v2; fLanes[3] = v3;
+    fBuffered = end - p;
+    memcpy(fBuffer, p, fBuffered);
+}
+
+
+uint64_t Hasher64::digest() const
+{
+    uint64_t h;
+    if (fTotal >= STRIPE) {
+        h = std::rotl(fLanes[0], 1) + std::rotl(fLanes[1], 7)
+          + std::rotl(fLanes[2], 12) + std::rotl(fLanes[3], 18);
+        for (auto lane : fLanes)
+            h = mergeRound(h, lane);
+    } else {
+        h = fSeed + P5;
+    }
+    h += fTotal;
+
+    auto p = fBuffer;
+    auto end = fBuffer + fBuffered;
+    for (; end - p >= 8; p += 8)
+        h = std::rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (end - p >= 4) {
+        h = std::rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = std::rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+uint64_t hashImage(const Image& im)
+{
+    const size_t w = im.width(), h = im.height();
+    const size_t rowBytes = w * sizeof(Rgba);
+    const size_t stripRows = std::max<size_t>(1, STRIP_BYTES / std::max<size_t>(rowBytes, 1));
+    const size_t nStrips = (h + stripRows - 1) / stripRows;
+
+    std::vector<uint64_t> strips(nStrips);
+    auto hashStrips = [&](size_t s0, size_t s1) {
+        for (size_t s = s0; s < s1; ++s) {
+            Hasher64 strip;
+            size_t y1 = std::min(h, (s + 1) * stripRows);
+            if (im.isContiguous()) {
+                strip.update(im.uncheckedScanLine(s * stripRows).data(),
+                             (y1 - s * stripRows) * rowBytes);
+            } else {
+                for (size_t y = s * stripRows; y < y1; ++y)
+                    strip.update(im.uncheckedScanLine(y).data(), rowBytes);
+            }
+            strips[s] = strip.digest();
+        }
+    };
+    if (im.nBytes() >= PARALLEL_HASH_BYTES) {
+        parallelFor(nStrips, 1, hashStrips);
+    } else {
+        hashStrips(0, nStrips);
+    }
+
+    Hasher64 r;
+    r.update(static_cast<uint64_t>(w));
+    r.update(static_cast<uint64_t>(h));
+    r.update(strips.data(), strips.size() * sizeof(uint64_t));
+    return r.digest();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#include "image.h"
+
+///
+///  Streaming XXH64: bytes can come in any pieces, the hash is the same
+///  as of XXH64 over all of them. Four independent lanes keep the CPU
+///  busy at about memory speed. Not cryptographic.
+///
+class Hasher64
+{
+public:
+    explicit Hasher64(uint64_t seed = 0);
+
+    void update(const void* data, size_t nBytes);
+    template <class T>
+    void update(const T& x)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        update(&x, sizeof(x));
+    }
+    /// Hash of everything so far; more can be added afterwards
+    uint64_t digest() const;
+private:
+    static constexpr size_t STRIPE = 32;
+    uint64_t fLanes[4];
+    unsigned char fBuffer[STRIPE];
+    size_t fBuffered = 0;
+    uint64_t fTotal = 0;
+    uint64_t fSeed;
+};
+
+inline uint64_t hash64(const void* data, size_t nBytes, uint64_t seed = 0)
+{
+    Hasher64 h(seed);
+    h.update(data, nBytes);
+    return h.digest();
+}
+
+/// Hash of size and pixels, padding is ignored. Big images are hashed in
+/// strips in thread pool; strips depend on size only, so the hash does
+/// not depend on number of threads.
+uint64_t hashImage(const Image& im);
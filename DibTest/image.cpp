@@ -0,0 +1,130 @@
+#include "image.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+
+#include "draw.h"
+
+
+void throwOutOfRange()
+{
+    throw std::out_of_range("y/x out of range");
+}
+
+
+Image::Image(const Image& x)
+    : fWidth(x.fWidth), fHeight(x.fHeight), fStride(x.fStride),
+      fData(x.fStride * x.fHeight), fRowVersions(x.fHeight, fVersion)
+{
+    ownData();
+    for (size_t y = 0; y < fHeight; ++y) {
+        auto src = x.uncheckedScanLine(y);
+        std::copy(src.begin(), src.end(), uncheckedScanLine(y).begin());
+    }
+}
+
+
+Image& Image::operator = (const Image& x)
+{
+    if (this != &x) {
+        Image tmp(x);
+        swap(tmp);
+    }
+    return *this;
+}
+
+
+Image& Image::operator = (Image&& x) noexcept
+{
+    Image tmp(std::move(x));
+    swap(tmp);
+    return *this;
+}
+
+
+void Image::swap(Image& x) noexcept
+{
+    std::swap(fWidth, x.fWidth);
+    std::swap(fHeight, x.fHeight);
+    std::swap(fStride, x.fStride);
+    std::swap(fPixels, x.fPixels);
+    fData.swap(x.fData);
+    fExternal.swap(x.fExternal);
+    std::swap(fId, x.fId);
+    std::swap(fVersion, x.fVersion);
+    fRowVersions.swap(x.fRowVersions);
+}
+
+
+Image Image::adopt(Rgba* pixels, size_t w, size_t h, size_t stride, Deleter deleter)
+{
+    if (stride < w)
+        throw std::logic_error("Stride is less than width");
+    Image r;
+    r.fWidth = w;
+    r.fHeight = h;
+    r.fStride = stride;
+    r.fPixels = pixels;
+    r.fRowVersions.assign(h, r.fVersion);
+    r.fExternal = std::unique_ptr<Rgba, ExternalDeleter>(
+            pixels, ExternalDeleter { .deleter = std::move(deleter) });
+    return r;
+}
+
+
+uint64_t Image::newId()
+{
+    static std::atomic<uint64_t> lastId = 0;
+    return ++lastId;
+}
+
+
+void Image::markDirty(size_t y0, size_t y1)
+{
+    y1 = std::min(y1, fHeight);
+    if (y0 < y1)
+        std::fill(fRowVersions.begin() + y0, fRowVersions.begin() + y1, fVersion);
+}
+
+
+void Image::ownData()
+{
+    fExternal.reset();
+    fPixels = fData.data();
+}
+
+
+void Image::setSize(size_t w, size_t h, Rows rows)
+{
+    constexpr size_t ALIGN_PIXELS = IMAGE_ALIGN / sizeof(Rgba);
+    fWidth = w;
+    fHeight = h;
+    fStride = (rows == Rows::ALIGNED)
+            ? (w + ALIGN_PIXELS - 1) / ALIGN_PIXELS * ALIGN_PIXELS
+            : w;
+    // New pixels, as nobody has seen them
+    fId = newId();
+    fRowVersions.assign(h, fVersion);
+}
+
+
+void Image::resize(size_t w, size_t h, Rgba color, Rows rows)
+{
+    setSize(w, h, rows);
+    // Big frames are filled in parallel, see draw.h
+    fData.clear();
+    fData.resize(fStride * h);
+    ownData();
+    fillPixels(fPixels, fData.size(), color);
+}
+
+
+void Image::resize(size_t w, size_t h, NoInit, Rows rows)
+{
+    setSize(w, h, rows);
+    // Old pixels are not needed, so do not let vector copy them over
+    fData.clear();
+    fData.resize(fStride * h);
+    ownData();
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <span>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+// Check for machine assumptions
+static_assert(std::endian::native == std::endian::little);
+
+
+struct Rgba {
+    unsigned char b = 0xFF, g = 0xFF, r = 0xFF, a = 0xFF;
+
+    static constexpr uint32_t A_MASK = 0xFF000000;
+    static constexpr uint32_t R_MASK =   0xFF0000;
+    static constexpr uint32_t G_MASK =     0xFF00;
+    static constexpr uint32_t B_MASK =       0xFF;
+};
+
+[[maybe_unused]] constexpr Rgba WHITE      { .b = 0xFF, .g = 0xFF, .r = 0xFF };
+[[maybe_unused]] constexpr Rgba AQUA       { .b = 0xFF, .g = 0xFF, .r = 0 };
+[[maybe_unused]] constexpr Rgba MISTY      { .b = 0xE1, .g = 0xE4, .r = 0xFF };
+[[maybe_unused]] constexpr Rgba SEMI_BLACK { .b = 0, .g = 0, .r = 0, .a = 0x40 };
+[[maybe_unused]] constexpr Rgba SEMI_AQUA  { .b = 0xFF, .g = 0xFF, .r = 0, .a = 0x40 };
+[[maybe_unused]] constexpr Rgba SEMI_PINK  { .b = 0xFF, .g = 0, .r = 0xFF, .a = 0x40 };
+[[maybe_unused]] constexpr Rgba RED        { .b = 0, .g = 0, .r = 0xFF };
+[[maybe_unused]] constexpr Rgba GREEN      { .b = 0, .g = 0xAA, .r = 0 };
+[[maybe_unused]] constexpr Rgba BLUE       { .b = 0xFF, .g = 0, .r = 0 };
+[[maybe_unused]] constexpr Rgba YELLOW     { .b = 0, .g = 0xD7, .r = 0xFF };
+
+// Checked mode: operator() checks bounds too; at() and scanLine() always do
+#ifndef IMAGE_CHECKED
+    #ifdef NDEBUG
+        #define IMAGE_CHECKED 0
+    #else
+        #define IMAGE_CHECKED 1
+    #endif
+#endif
+
+[[noreturn]] void throwOutOfRange();
+
+/// Alignment of image buffers and of aligned rows, enough for AVX-512
+/// loads and for a cache line
+constexpr size_t IMAGE_ALIGN = 64;
+
+/// Allocator whose containers leave elements uninitialized on resize,
+/// and whose buffers are IMAGE_ALIGN-aligned.
+/// Only for implicit-lifetime types, such as Rgba.
+template <class T>
+struct NoInitAllocator : std::allocator<T>
+{
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+    template <class U> struct rebind { using other = NoInitAllocator<U>; };
+
+    NoInitAllocator() noexcept = default;
+    template <class U>
+        NoInitAllocator(const NoInitAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+        { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{IMAGE_ALIGN})); }
+    void deallocate(T* p, size_t) noexcept
+        { ::operator delete(p, std::align_val_t{IMAGE_ALIGN}); }
+
+    /// Value-initialization does nothing, everything else is as usual
+    template <class U>
+        void construct(U*) noexcept {}
+};
+
+/// Tag: resize without initializing pixels
+struct NoInit { explicit NoInit() = default; };
+inline constexpr NoInit NO_INIT {};
+
+/// Row layout: packed (stride = width) or every row starting at
+/// IMAGE_ALIGN boundary, for aligned SIMD and for splitting between threads
+enum class Rows : bool { PACKED, ALIGNED };
+
+class Image {
+public:
+    /// Releases adopted pixels; empty deleter means non-owning view
+    using Deleter = std::function<void(Rgba*)>;
+
+    Image() = default;
+    Image(size_t w, size_t h, Rgba color, Rows rows = Rows::PACKED)
+        { resize(w, h, color, rows); }
+    Image(size_t w, size_t h, NoInit, Rows rows = Rows::PACKED)
+        { resize(w, h, NO_INIT, rows); }
+    /// Copy of adopted image owns its pixels
+    Image(const Image& x);
+    Image(Image&& x) noexcept { swap(x); }
+    Image& operator = (const Image& x);
+    Image& operator = (Image&& x) noexcept;
+    void swap(Image& x) noexcept;
+
+    /// Wraps w×h pixels someone else allocated (pool, mapped readback
+    /// buffer…) without copying them. Rows are stride pixels apart.
+    /// The image calls deleter when it no longer needs them;
+    /// with no deleter pixels should outlive the image.
+    static Image adopt(Rgba* pixels, size_t w, size_t h, size_t stride,
+                       Deleter deleter = {});
+    static Image adopt(Rgba* pixels, size_t w, size_t h, Deleter deleter = {})
+        { return adopt(pixels, w, h, w, std::move(deleter)); }
+    bool isAdopted() const { return static_cast<bool>(fExternal); }
+
+    /// Writes every pixel once
+    void resize(size_t w, size_t h, Rgba color, Rows rows = Rows::PACKED);
+    /// Leaves pixels garbage, for callers that overwrite all of them
+    void resize(size_t w, size_t h, NoInit, Rows rows = Rows::PACKED);
+    /// Writes through non-const accessors stamp rows with current version;
+    /// data() stamps all of them
+    Rgba& at(size_t y, size_t x)
+        { checkPixel(y, x); touchRow(y); return uncheckedAt(y, x); }
+    const Rgba& at(size_t y, size_t x) const
+        { checkPixel(y, x); return uncheckedAt(y, x); }
+    /// No bounds check and no stamp, for hot loops: call markDirty after
+    Rgba& uncheckedAt(size_t y, size_t x) { return fPixels[y * fStride + x]; }
+    const Rgba& uncheckedAt(size_t y, size_t x) const { return fPixels[y * fStride + x]; }
+    /// Checked only in checked mode
+    Rgba& operator () (size_t y, size_t x);
+    const Rgba& operator ()(size_t y, size_t x) const;
+    size_t width() const { return fWidth; }
+    size_t height() const { return fHeight; }
+    /// Distance between rows, in pixels
+    size_t stride() const { return fStride; }
+    size_t strideBytes() const { return fStride * sizeof(Rgba); }
+    /// Rows go one after another, with no padding
+    bool isContiguous() const { return fStride == fWidth; }
+    size_t area() const { return fWidth * fHeight; }
+    /// Bytes of pixels, without padding (what DIB data takes)
+    size_t nBytes() const { return area() * sizeof(Rgba); }
+    std::span<Rgba> scanLine(size_t y)
+        { checkRow(y); return uncheckedScanLine(y); }
+    std::span<const Rgba> scanLine(size_t y) const
+        { checkRow(y); return uncheckedScanLine(y); }
+    std::span<Rgba> uncheckedScanLine(size_t y)
+        { touchRow(y); return { fPixels + (y * fStride), fWidth }; }
+    std::span<const Rgba> uncheckedScanLine(size_t y) const
+        { return { fPixels + (y * fStride), fWidth }; }
+    /// First row; rows are stride() pixels apart
+    Rgba* data() { markDirty(0, fHeight); return fPixels; }
+    const Rgba* data() const { return fPixels; }
+
+    /// Unique per pixel buffer: new on construction, copy and resize,
+    /// travels with move and swap
+    uint64_t id() const { return fId; }
+    uint64_t rowVersion(size_t y) const { return fRowVersions[y]; }
+    /// Closes current version, so that later writes get a newer stamp
+    /// @return  version closed: rows stamped newer were written after it
+    uint64_t closeVersion() const { return fVersion++; }
+    /// Stamps rows [y0, y1) for writes the image cannot see: through
+    /// uncheckedAt, or spans and pointers kept from before closeVersion
+    void markDirty(size_t y0, size_t y1);
+private:
+    struct ExternalDeleter {
+        Deleter deleter;
+        void operator () (Rgba* p) const { if (deleter) deleter(p); }
+    };
+
+    size_t fWidth = 0, fHeight = 0, fStride = 0;
+    /// Either fData.data() or fExternal.get()
+    Rgba* fPixels = nullptr;
+    std::vector<Rgba, NoInitAllocator<Rgba>> fData;
+    std::unique_ptr<Rgba, ExternalDeleter> fExternal;
+    uint64_t fId = newId();
+    mutable uint64_t fVersion = 1;
+    std::vector<uint64_t> fRowVersions;
+
+    static uint64_t newId();
+    void touchRow(size_t y) { fRowVersions[y] = fVersion; }
+    void ownData();
+    void setSize(size_t w, size_t h, Rows rows);
+
+    // Thrower is out of line, so that the check is cheap and can be hoisted
+    void checkRow(size_t y) const
+        { if (y >= fHeight) [[unlikely]] throwOutOfRange(); }
+    void checkPixel(size_t y, size_t x) const
+        { if (y >= fHeight || x >= fWidth) [[unlikely]] throwOutOfRange(); }
+};
+
+#if IMAGE_CHECKED
+    inline Rgba& Image::operator () (size_t y, size_t x) { return at(y, x); }
+    inline const Rgba& Image::operator ()(size_t y, size_t x) const { return at(y, x); }
+#else
+    inline Rgba& Image::operator () (size_t y, size_t x) { touchRow(y); return uncheckedAt(y, x); }
+    inline const Rgba& Image::operator ()(size_t y, size_t x) const { return uncheckedAt(y, x); }
+#endif
@@ -0,0 +1,119 @@
+#include "parallel.h"
+
+#include <algorithm>
+
+/// Thread works on a batch: a worker, or a caller inside its own run()
+static thread_local bool isInBatch = false;
+
+ThreadPool& ThreadPool::instance()
+{
+    static ThreadPool inst;
+    return inst;
+}
+
+ThreadPool::ThreadPool()
+{
+    auto nHardware = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned i = 1; i < nHardware; ++i)
+        fWorkers.emplace_back([this] { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(fMutex);
+        fQuit = true;
+    }
+    fWake.notify_all();
+    for (auto& worker : fWorkers)
+        worker.join();
+}
+
+void ThreadPool::Batch::process()
+{
+    for (;;) {
+        auto i = next.fetch_add(1);
+        if (i >= nTasks)
+            return;
+        try {
+            task(i);
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+        if (remaining.fetch_sub(1) == 1) {
+            std::lock_guard lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    isInBatch = true;
+    uint64_t seen = 0;
+    for (;;) {
+        std::shared_ptr<Batch> batch;
+        {
+            std::unique_lock lock(fMutex);
+            fWake.wait(lock, [&] { return fQuit || (fBatch && fGeneration != seen); });
+            if (fQuit)
+                return;
+            seen = fGeneration;
+            batch = fBatch;
+        }
+        // Late workers see an exhausted batch and just return
+        batch->process();
+    }
+}
+
+void ThreadPool::run(size_t nTasks, const Task& task)
+{
+    if (nTasks == 0)
+        return;
+    if (isInBatch || nTasks == 1 || fWorkers.empty()) {
+        for (size_t i = 0; i < nTasks; ++i)
+            task(i);
+        return;
+    }
+
+    // One batch at a time
+    std::lock_guard runLock(fRunMutex);
+    auto batch = std::make_shared<Batch>(task, nTasks);
+    {
+        std::lock_guard lock(fMutex);
+        fBatch = batch;
+        ++fGeneration;
+    }
+    fWake.notify_all();
+
+    // Nested run() from caller’s tasks must not take fRunMutex again
+    isInBatch = true;
+    batch->process();
+    isInBatch = false;
+    {
+        std::unique_lock lock(batch->mutex);
+        batch->done.wait(lock, [&] { return batch->remaining == 0; });
+    }
+    {
+        std::lock_guard lock(fMutex);
+        fBatch.reset();
+    }
+    if (batch->error)
+        std::rethrow_exception(batch->error);
+}
+
+void parallelFor(size_t n, size_t minBlock,
+                 const std::function<void(size_t, size_t)>& body)
+{
+    if (n == 0)
+        return;
+    auto& pool = ThreadPool::instance();
+    // A few blocks per thread even out uneven progress
+    size_t nBlocks = std::min(pool.nThreads() * 4,
+                              std::max<size_t>(n / std::max<size_t>(minBlock, 1), 1));
+    pool.run(nBlocks, [&](size_t i) {
+        body(n * i / nBlocks, n * (i + 1) / nBlocks);
+    });
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+///  Fixed pool of hardware_concurrency − 1 workers; the thread that runs
+///  a batch works on it too.
+///
+class ThreadPool
+{
+public:
+    using Task = std::function<void(size_t)>;
+
+    static ThreadPool& instance();
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    /// Workers + caller
+    size_t nThreads() const { return fWorkers.size() + 1; }
+    /// Runs task(0) … task(nTasks − 1) and waits for all of them.
+    /// Rethrows first exception of tasks. Called from inside a task, on
+    /// a worker or on the thread that runs the batch, runs everything
+    /// serially rather than deadlock.
+    void run(size_t nTasks, const Task& task);
+private:
+    struct Batch {
+        const Task& task;
+        size_t nTasks;
+        std::atomic<size_t> next = 0, remaining;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+
+        Batch(const Task& aTask, size_t aNTasks)
+            : task(aTask), nTasks(aNTasks), remaining(aNTasks) {}
+        void process();
+    };
+
+    ThreadPool();
+    void workerLoop();
+
+    std::vector<std::thread> fWorkers;
+    std::mutex fMutex, fRunMutex;
+    std::condition_variable fWake;
+    std::shared_ptr<Batch> fBatch;
+    uint64_t fGeneration = 0;
+    bool fQuit = false;
+};
+
+/// Splits [0, n) into blocks of at least minBlock items, one or more per
+/// thread, and runs body(begin, end) for each of them in thread pool
+void parallelFor(size_t n, size_t minBlock,
+                 const std::function<void(size_t, size_t)>& body);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#include "image.h"
+
+///
+///  Compile-time pixel format: little-endian pixels of Bytes bytes, with
+///  channel masks. Zero alpha mask means opaque. Channels of any width
+///  up to 16 bits are scaled to/from 8 bits with rounding.
+///  Every conversion is resolved at compile time, and plain loops over
+///  such pixels are left for the compiler to vectorize.
+///
+template <unsigned Bytes, uint64_t RMask, uint64_t GMask, uint64_t BMask, uint64_t AMask = 0>
+struct PixelFormat
+{
+    static_assert(Bytes >= 1 && Bytes <= 8);
+    static constexpr unsigned BYTES = Bytes;
+    static constexpr bool HAS_ALPHA = (AMask != 0);
+
+    struct Channel {
+        uint64_t mask;
+        unsigned shift, nBits;
+
+        constexpr Channel(uint64_t aMask)
+            : mask(aMask), shift(aMask ? std::countr_zero(aMask) : 0),
+              nBits(std::popcount(aMask)) {}
+        constexpr uint32_t max() const { return (uint32_t(1) << nBits) - 1; }
+
+        /// Channel of pixel → 0…255
+        constexpr unsigned char get(uint64_t pixel) const
+        {
+            uint32_t v = (pixel & mask) >> shift;
+            if (nBits == 8)
+                return v;
+            return (v * 255 + max() / 2) / max();
+        }
+
+        /// 0…255 → channel bits of pixel
+        constexpr uint64_t put(unsigned char c) const
+        {
+            uint32_t v = (nBits == 8) ? c : (c * max() + 127) / 255;
+            return uint64_t(v) << shift;
+        }
+    };
+
+    static constexpr Channel R { RMask }, G { GMask }, B { BMask }, A { AMask };
+    static_assert(R.nBits <= 16 && G.nBits <= 16 && B.nBits <= 16 && A.nBits <= 16);
+    static_assert((RMask & GMask) == 0 && (RMask & BMask) == 0 && (GMask & BMask) == 0
+                  && ((RMask | GMask | BMask) & AMask) == 0, "Masks overlap");
+
+    static uint64_t load(const unsigned char* p)
+    {
+        uint64_t v = 0;
+        memcpy(&v, p, BYTES);
+        return v;
+    }
+
+    static void store(unsigned char* p, uint64_t v)
+        { memcpy(p, &v, BYTES); }
+
+    static Rgba toRgba(const unsigned char* p)
+    {
+        auto v = load(p);
+        return Rgba { .b = B.get(v), .g = G.get(v), .r = R.get(v),
+                      .a = HAS_ALPHA ? A.get(v) : static_cast<unsigned char>(0xFF) };
+    }
+
+    static void fromRgba(Rgba c, unsigned char* p)
+    {
+        uint64_t v = R.put(c.r) | G.put(c.g) | B.put(c.b);
+        if constexpr (HAS_ALPHA)
+            v |= A.put(c.a);
+        store(p, v);
+    }
+};
+
+using PixBgra8  = PixelFormat<4, 0xFF0000, 0xFF00, 0xFF, 0xFF000000>;
+using PixRgba8  = PixelFormat<4, 0xFF, 0xFF00, 0xFF0000, 0xFF000000>;
+using PixBgrx8  = PixelFormat<4, 0xFF0000, 0xFF00, 0xFF>;
+using PixRgb24  = PixelFormat<3, 0xFF, 0xFF00, 0xFF0000>;
+using PixBgr24  = PixelFormat<3, 0xFF0000, 0xFF00, 0xFF>;
+using PixRgb565 = PixelFormat<2, 0xF800, 0x07E0, 0x001F>;
+using PixRgba16 = PixelFormat<8, 0xFFFF, 0xFFFF'0000, 0xFFFF'0000'0000, 0xFFFF'0000'0000'0000>;
+
+template <class Fmt>
+void convertToRgba(const unsigned char* src, Rgba* dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = Fmt::toRgba(src + i * Fmt::BYTES);
+}
+
+template <class Fmt>
+void convertFromRgba(const Rgba* src, unsigned char* dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        Fmt::fromRgba(src[i], dst + i * Fmt::BYTES);
+}
+
+///
+///  Read-only pixels of format Fmt that someone else owns
+///
+template <class Fmt>
+struct PixelView
+{
+    const unsigned char* data = nullptr;
+    size_t width = 0, height = 0;
+    /// Distance between rows
+    size_t strideBytes = 0;
+
+    PixelView() = default;
+    PixelView(const void* aData, size_t aWidth, size_t aHeight, size_t aStrideBytes = 0)
+        : data(static_cast<const unsigned char*>(aData)), width(aWidth), height(aHeight),
+          strideBytes(aStrideBytes ? aStrideBytes : aWidth * Fmt::BYTES) {}
+
+    const unsigned char* row(size_t y) const { return data + y * strideBytes; }
+};
+
+/// Converts the whole view to a new packed Image
+template <class Fmt>
+Image toImage(const PixelView<Fmt>& src)
+{
+    Image r(src.width, src.height, NO_INIT);
+    for (size_t y = 0; y < src.height; ++y)
+        convertToRgba<Fmt>(src.row(y), r.uncheckedScanLine(y).data(), src.width);
+    return r;
+}
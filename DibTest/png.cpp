@@ -0,0 +1,339 @@
+#include "png.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "parallel.h"
+#include "trace.h"
+
+/// Rows per strip, not fewer
+constexpr size_t PNG_MIN_STRIP_ROWS = 64;
+/// Sides and chunk lengths are 31-bit
+constexpr size_t PNG_MAX_VALUE = 0x7FFFFFFF;
+
+///// CRC-32 and Adler-32 ///////////////////////////////////////////////////
+
+static const std::array<uint32_t, 256>& crcTable()
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> r;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            r[i] = c;
+        }
+        return r;
+    }();
+    return table;
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char* p, size_t n)
+{
+    auto& table = crcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+constexpr uint32_t ADLER_BASE = 65521;
+
+static uint32_t adler32(const unsigned char* p, size_t n)
+{
+    // 5552 bytes is the most sums can take before overflow
+    constexpr size_t NMAX = 5552;
+    uint32_t a = 1, b = 0;
+    while (n > 0) {
+        auto chunk = std::min(n, NMAX);
+        n -= chunk;
+        for (size_t i = 0; i < chunk; ++i) {
+            a += p[i];
+            b += a;
+        }
+        p += chunk;
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return (b << 16) | a;
+}
+
+/// Adler-32 of concatenation, as zlib’s adler32_combine does
+static uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t len2)
+{
+    uint32_t rem = len2 % ADLER_BASE;
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (uint64_t(rem) * sum1) % ADLER_BASE;
+    sum1 += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+    sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + ADLER_BASE - rem;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum2 >= (ADLER_BASE << 1)) sum2 -= (ADLER_BASE << 1);
+    if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+    return sum1 | (sum2 << 16);
+}
+
+///// Deflate /////////////////////////////////////////////////////////////////
+
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : fOut(out) {}
+
+    /// Writes n ≤ 32 bits, LSB first
+    void put(uint32_t bits, unsigned n)
+    {
+        fBuf |= uint64_t(bits) << fNBits;
+        fNBits += n;
+        while (fNBits >= 8) {
+            fOut.push_back(static_cast<unsigned char>(fBuf));
+            fBuf >>= 8;
+            fNBits -= 8;
+        }
+    }
+
+    /// Huffman codes go MSB first
+    void putCode(uint32_t code, unsigned n)
+        { put(reverse(code, n), n); }
+
+    void alignToByte()
+    {
+        if (fNBits > 0)
+            put(0, 8 - fNBits);
+    }
+private:
+    std::vector<unsigned char>& fOut;
+    uint64_t fBuf = 0;
+    unsigned fNBits = 0;
+
+    static uint32_t reverse(uint32_t code, unsigned n)
+    {
+        uint32_t r = 0;
+        for (unsigned i = 0; i < n; ++i) {
+            r = (r << 1) | (code & 1);
+            code >>= 1;
+        }
+        return r;
+    }
+};
+
+constexpr std::array<uint16_t, 29> LENGTH_BASE {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr std::array<uint8_t, 29> LENGTH_EXTRA {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr std::array<uint16_t, 30> DIST_BASE {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr std::array<uint8_t, 30> DIST_EXTRA {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+constexpr size_t WINDOW = 32768;
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_MATCH = 258;
+constexpr unsigned HASH_BITS = 15;
+
+/// Literal/length symbol with fixed Huffman code
+static void putSymbol(BitWriter& w, unsigned sym)
+{
+    if (sym < 144)
+        w.putCode(0x30 + sym, 8);
+    else if (sym < 256)
+        w.putCode(0x190 + (sym - 144), 9);
+    else if (sym < 280)
+        w.putCode(sym - 256, 7);
+    else
+        w.putCode(0xC0 + (sym - 280), 8);
+}
+
+static void putMatch(BitWriter& w, size_t len, size_t dist)
+{
+    size_t lc = LENGTH_BASE.size() - 1;
+    while (LENGTH_BASE[lc] > len)
+        --lc;
+    putSymbol(w, 257 + lc);
+    w.put(len - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+
+    size_t dc = DIST_BASE.size() - 1;
+    while (DIST_BASE[dc] > dist)
+        --dc;
+    w.putCode(dc, 5);
+    w.put(dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+}
+
+static inline uint32_t hash4(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/// Compresses data as one fixed-Huffman block. Non-final blocks are
+/// followed by an empty stored block, so the output ends on byte boundary
+/// and compressed strips can be just put one after another.
+static void deflateStrip(const unsigned char* data, size_t n, bool isFinal,
+                         std::vector<unsigned char>& out)
+{
+    BitWriter w(out);
+    w.put(isFinal ? 1 : 0, 1);
+    w.put(1, 2);    // fixed Huffman
+
+    // Positions + 1, 0 = none. They wrap past 4 GiB, which only matters
+    // within window: distance is taken mod 2³², and matches are compared
+    std::vector<uint32_t> head(size_t(1) << HASH_BITS, 0);
+    size_t i = 0;
+    while (i + MIN_MATCH <= n) {
+        auto h = hash4(data + i);
+        auto tag = static_cast<uint32_t>(i + 1);
+        auto cand = head[h];
+        head[h] = tag;
+        size_t dist = static_cast<uint32_t>(tag - cand);
+        if (cand != 0 && dist != 0 && dist <= WINDOW && dist <= i
+                && memcmp(data + i - dist, data + i, MIN_MATCH) == 0) {
+            auto match = data + i - dist;
+            size_t maxLen = std::min(MAX_MATCH, n - i);
+            size_t len = MIN_MATCH;
+            while (len < maxLen && match[len] == data[i + len])
+                ++len;
+            putMatch(w, len, dist);
+            i += len;
+        } else {
+            putSymbol(w, data[i]);
+            ++i;
+        }
+    }
+    for (; i < n; ++i)
+        putSymbol(w, data[i]);
+    putSymbol(w, 256);
+
+    if (!isFinal) {
+        // Sync flush: empty stored block
+        w.put(0, 3);
+        w.alignToByte();
+        w.put(0x0000, 16);
+        w.put(0xFFFF, 16);
+    }
+    w.alignToByte();
+}
+
+///// PNG /////////////////////////////////////////////////////////////////////
+
+static void putBigEndian(std::string& s, uint32_t v)
+{
+    s += static_cast<char>(v >> 24);
+    s += static_cast<char>(v >> 16);
+    s += static_cast<char>(v >> 8);
+    s += static_cast<char>(v);
+}
+
+static void putChunk(std::string& s, const char* type, const unsigned char* data, size_t n)
+{
+    putBigEndian(s, n);
+    auto typeStart = s.size();
+    s.append(type, 4);
+    s.append(reinterpret_cast<const char*>(data), n);
+    auto crc = crc32(0, reinterpret_cast<const unsigned char*>(s.data() + typeStart), 4);
+    crc = crc32(crc, data, n);
+    putBigEndian(s, crc);
+}
+
+/// Writes PNG row: filter byte, then RGBA bytes,
+/// filtered with “Up” if there’s previous row
+static void filterRow(unsigned char* dest, std::span<const Rgba> row,
+                      std::span<const Rgba> prev)
+{
+    if (prev.empty()) {
+        *(dest++) = 0;
+        for (auto c : row) {
+            *(dest++) = c.r;
+            *(dest++) = c.g;
+            *(dest++) = c.b;
+            *(dest++) = c.a;
+        }
+        return;
+    }
+    *(dest++) = 2;
+    for (size_t x = 0; x < row.size(); ++x) {
+        auto c = row[x], p = prev[x];
+        *(dest++) = c.r - p.r;
+        *(dest++) = c.g - p.g;
+        *(dest++) = c.b - p.b;
+        *(dest++) = c.a - p.a;
+    }
+}
+
+std::string encodePng(const Image& im)
+{
+    std::string r;
+    encodePng(im, r);
+    return r;
+}
+
+void encodePng(const Image& im, std::string& out)
+{
+    TRACE_SCOPE("encodePng");
+    if (im.width() > PNG_MAX_VALUE || im.height() > PNG_MAX_VALUE) [[unlikely]]
+        throw std::logic_error("Image is too big for PNG");
+    struct Strip {
+        std::vector<unsigned char> deflated;
+        uint32_t adler = 1;
+        size_t nRawBytes = 0;
+    };
+
+    auto h = im.height();
+    auto rowBytes = im.width() * 4 + 1;
+    size_t nStrips = std::max<size_t>(1,
+            std::min(ThreadPool::instance().nThreads() * 2, h / PNG_MIN_STRIP_ROWS));
+    std::vector<Strip> strips(nStrips);
+    ThreadPool::instance().run(nStrips, [&](size_t iStrip) {
+        size_t y0 = h * iStrip / nStrips, y1 = h * (iStrip + 1) / nStrips;
+        std::vector<unsigned char> raw((y1 - y0) * rowBytes);
+        for (size_t y = y0; y < y1; ++y) {
+            filterRow(raw.data() + (y - y0) * rowBytes, im.uncheckedScanLine(y),
+                      y ? im.uncheckedScanLine(y - 1) : std::span<const Rgba>{});
+        }
+        auto& strip = strips[iStrip];
+        strip.nRawBytes = raw.size();
+        strip.adler = adler32(raw.data(), raw.size());
+        strip.deflated.reserve(raw.size() / 4 + 64);
+        deflateStrip(raw.data(), raw.size(), iStrip + 1 == nStrips, strip.deflated);
+    });
+
+    // Keeps capacity
+    out.assign("\x89PNG\r\n\x1A\n", 8);
+    // IHDR: RGBA 8 bit, no interlace
+    std::array<unsigned char, 13> ihdr {};
+    for (int i = 0; i < 4; ++i) {
+        ihdr[i] = static_cast<unsigned char>(im.width() >> (24 - 8 * i));
+        ihdr[4 + i] = static_cast<unsigned char>(h >> (24 - 8 * i));
+    }
+    ihdr[8] = 8;    // bit depth
+    ihdr[9] = 6;    // RGBA
+    putChunk(out, "IHDR", ihdr.data(), ihdr.size());
+
+    // zlib stream: header, strips, Adler-32 of all raw data
+    uint32_t adler = 1;
+    for (size_t i = 0; i < nStrips; ++i) {
+        auto& strip = strips[i];
+        adler = (i == 0) ? strip.adler : adler32Combine(adler, strip.adler, strip.nRawBytes);
+        if (i == 0) {
+            // 32K window, deflate, fastest; header is multiple of 31
+            strip.deflated.insert(strip.deflated.begin(), { 0x78, 0x01 });
+        }
+        if (i + 1 == nStrips) {
+            for (int k = 3; k >= 0; --k)
+                strip.deflated.push_back(static_cast<unsigned char>(adler >> (8 * k)));
+        }
+        // Chunk boundaries may fall anywhere in zlib stream
+        for (size_t k = 0; k < strip.deflated.size(); k += PNG_MAX_VALUE) {
+            putChunk(out, "IDAT", strip.deflated.data() + k,
+                     std::min(PNG_MAX_VALUE, strip.deflated.size() - k));
+        }
+        strip.deflated = {};
+    }
+    putChunk(out, "IEND", nullptr, 0);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include "image.h"
+
+///
+///  Fast PNG encoder for clipboard: RGBA 8-bit, “Up” filter, deflate with
+///  fixed Huffman codes and single-probe LZ77 (about zlib level 1).
+///  Row strips are compressed in thread pool and joined with sync flushes,
+///  each strip going to its own IDAT chunk.
+///
+std::string encodePng(const Image& im);
+
+/// Same, into out, reusing its memory
+void encodePng(const Image& im, std::string& out);
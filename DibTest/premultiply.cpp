@@ -0,0 +1,151 @@
+#include "premultiply.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define PREMUL_X86 1
+    #include <emmintrin.h>
+    #if defined(__GNUC__)
+        #define PREMUL_AVX2 1
+        #include <immintrin.h>
+    #endif
+#elif defined(__ARM_NEON)
+    #define PREMUL_NEON 1
+    #include <arm_neon.h>
+#endif
+
+
+void premultiplyScalar(Rgba* dst, const Rgba* src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        auto c = src[i];
+        dst[i] = Rgba { .b = mulAlpha(c.b, c.a), .g = mulAlpha(c.g, c.a),
+                        .r = mulAlpha(c.r, c.a), .a = c.a };
+    }
+}
+
+static unsigned char divAlpha(unsigned c, unsigned a)
+{
+    return static_cast<unsigned char>(std::min(255u, (c * 255 + a / 2) / a));
+}
+
+void unpremultiply(Rgba* p, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        auto& c = p[i];
+        if (c.a == 0xFF)
+            continue;
+        if (c.a == 0) {
+            c = Rgba { .b = 0, .g = 0, .r = 0, .a = 0 };
+            continue;
+        }
+        c = Rgba { .b = divAlpha(c.b, c.a), .g = divAlpha(c.g, c.a),
+                   .r = divAlpha(c.r, c.a), .a = c.a };
+    }
+}
+
+#if PREMUL_X86
+
+/// 2 pixels in 16-bit lanes → premultiplied
+inline __m128i premultiply16(__m128i px)
+{
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i alphaOne = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    const __m128i half = _mm_set1_epi16(128);
+    // Every colour lane gets its pixel’s alpha, alpha lane gets 255
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xFF), 0xFF);
+    a = _mm_or_si128(_mm_andnot_si128(alphaLanes, a), alphaOne);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, a), half);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+void premultiplySse2(Rgba* dst, const Rgba* src, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = premultiply16(_mm_unpacklo_epi8(px, zero));
+        __m128i hi = premultiply16(_mm_unpackhi_epi8(px, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    premultiplyScalar(dst + i, src + i, n - i);
+}
+
+#if PREMUL_AVX2
+
+/// 4 pixels in 16-bit lanes → premultiplied
+__attribute__((target("avx2")))
+inline __m256i premultiply16(__m256i px)
+{
+    const __m256i alphaLanes = _mm256_set_epi16(
+            -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+    const __m256i alphaOne = _mm256_set_epi16(
+            255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+    const __m256i half = _mm256_set1_epi16(128);
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xFF), 0xFF);
+    a = _mm256_or_si256(_mm256_andnot_si256(alphaLanes, a), alphaOne);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(px, a), half);
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+void premultiplyAvx2(Rgba* dst, const Rgba* src, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        // unpack and pack both work within 128-bit halves, so order is kept
+        __m256i lo = premultiply16(_mm256_unpacklo_epi8(px, zero));
+        __m256i hi = premultiply16(_mm256_unpackhi_epi8(px, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    premultiplySse2(dst + i, src + i, n - i);
+}
+
+#endif  // PREMUL_AVX2
+#endif  // PREMUL_X86
+
+#if PREMUL_NEON
+
+void premultiplyNeon(Rgba* dst, const Rgba* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        auto px = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        // (x + ((x + 128) >> 8) + 128) >> 8, same as mulAlpha
+        for (int j = 0; j < 3; ++j) {
+            uint16x8_t t = vmull_u8(px.val[j], px.val[3]);
+            px.val[j] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+        }
+        vst4_u8(reinterpret_cast<uint8_t*>(dst + i), px);
+    }
+    premultiplyScalar(dst + i, src + i, n - i);
+}
+
+#endif  // PREMUL_NEON
+
+using PremultiplyFn = void (*)(Rgba* dst, const Rgba* src, size_t n);
+
+PremultiplyFn choosePremultiply()
+{
+#if PREMUL_X86
+    #if PREMUL_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return premultiplyAvx2;
+    #endif
+    return premultiplySse2;
+#elif PREMUL_NEON
+    return premultiplyNeon;
+#else
+    return premultiplyScalar;
+#endif
+}
+
+void premultiplyCopy(Rgba* dst, const Rgba* src, size_t n)
+{
+    static const PremultiplyFn fn = choosePremultiply();
+    fn(dst, src, n);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "image.h"
+
+///
+///  Premultiplied alpha: c’ = round(c·a/255), alpha itself stays.
+///  All kernels give bit-exact results of mulAlpha.
+///
+
+inline unsigned char mulAlpha(unsigned c, unsigned a)
+{
+    unsigned t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+void premultiplyScalar(Rgba* dst, const Rgba* src, size_t n);
+
+/// Copies n pixels from src to dst, premultiplying them; dst may be src.
+/// Uses the best kernel for this CPU.
+void premultiplyCopy(Rgba* dst, const Rgba* src, size_t n);
+
+/// Undoes premultiplication in place: c = round(c’·255/a), clamped, and
+/// 0 where a = 0. Scalar, it runs only on paste.
+void unpremultiply(Rgba* p, size_t n);
@@ -0,0 +1,56 @@
+#include "rowsource.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "parallel.h"
+
+BandRowSource::BandRowSource(size_t width, size_t height, size_t bandHeight,
+                             ProduceBand produceBand)
+    : fWidth(width), fHeight(height), fBandHeight(std::max<size_t>(bandHeight, 1)),
+      fProduceBand(std::move(produceBand))
+{
+    if (!fProduceBand)
+        throw std::logic_error("Band producer is empty");
+}
+
+TiledRowSource::TiledRowSource(size_t width, size_t height, size_t tileWidth, size_t tileHeight,
+                               RenderTile renderTile, Concurrent concurrent)
+    : fWidth(width), fHeight(height), fTileWidth(tileWidth), fTileHeight(tileHeight),
+      fRenderTile(std::move(renderTile)), fConcurrent(concurrent)
+{
+    if (tileWidth == 0 || tileHeight == 0)
+        throw std::logic_error("Tile is empty");
+    if (!fRenderTile)
+        throw std::logic_error("Tile renderer is empty");
+}
+
+void TiledRowSource::produceRows(size_t y0, size_t nRows, char* dest, ptrdiff_t strideBytes)
+{
+    size_t nTiles = (fWidth + fTileWidth - 1) / fTileWidth;
+    // Tiles of a band write disjoint columns of the same rows
+    auto renderTiles = [&](size_t i0, size_t i1) {
+        for (size_t i = i0; i < i1; ++i) {
+            size_t x0 = i * fTileWidth;
+            size_t w = std::min(fTileWidth, fWidth - x0);
+            fRenderTile(x0, y0, w, nRows, dest + x0 * sizeof(Rgba), strideBytes);
+        }
+    };
+    if (fConcurrent == Concurrent::YES) {
+        parallelFor(nTiles, 1, renderTiles);
+    } else {
+        renderTiles(0, nTiles);
+    }
+}
+
+Image toImage(RowSource& src)
+{
+    Image r(src.width(), src.height(), NO_INIT);
+    auto band = std::max<size_t>(src.bandHeight(), 1);
+    for (size_t y0 = 0; y0 < r.height(); y0 += band) {
+        auto n = std::min(band, r.height() - y0);
+        src.produceRows(y0, n, reinterpret_cast<char*>(r.uncheckedScanLine(y0).data()),
+                        r.strideBytes());
+    }
+    return r;
+}
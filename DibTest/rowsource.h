@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#include "image.h"
+
+///
+///  Produces image rows on demand, so that an image never has to be
+///  resident as a whole: writers pull bands of rows straight into their
+///  destination, e.g. clipboard memory.
+///
+class RowSource
+{
+public:
+    virtual ~RowSource() = default;
+    virtual size_t width() const = 0;
+    virtual size_t height() const = 0;
+    /// Rows per call the source is most efficient with, e.g. tile height
+    virtual size_t bandHeight() const { return 64; }
+    /// Writes rows [y0, y0 + nRows) as straight-alpha Rgba to dest;
+    /// row y0 + i starts at dest + i * strideBytes, stride may be negative
+    virtual void produceRows(size_t y0, size_t nRows, char* dest, ptrdiff_t strideBytes) = 0;
+};
+
+/// Whether callback may be called from several threads at once
+enum class Concurrent : bool { NO, YES };
+
+///
+///  Row source over a callback that renders bands of rows
+///
+class BandRowSource : public RowSource
+{
+public:
+    using ProduceBand = std::function<void(size_t y0, size_t nRows, char* dest,
+                                           ptrdiff_t strideBytes)>;
+
+    BandRowSource(size_t width, size_t height, size_t bandHeight, ProduceBand produceBand);
+    size_t width() const override { return fWidth; }
+    size_t height() const override { return fHeight; }
+    size_t bandHeight() const override { return fBandHeight; }
+    void produceRows(size_t y0, size_t nRows, char* dest, ptrdiff_t strideBytes) override
+        { fProduceBand(y0, nRows, dest, strideBytes); }
+private:
+    size_t fWidth, fHeight, fBandHeight;
+    ProduceBand fProduceBand;
+};
+
+///
+///  Row source over a tile renderer: every band is one row of tiles,
+///  each tile rendered right into the destination rectangle.
+///  Edge tiles are cropped to the image.
+///
+class TiledRowSource : public RowSource
+{
+public:
+    using RenderTile = std::function<void(size_t x0, size_t y0, size_t width, size_t height,
+                                          char* dest, ptrdiff_t strideBytes)>;
+
+    TiledRowSource(size_t width, size_t height, size_t tileWidth, size_t tileHeight,
+                   RenderTile renderTile, Concurrent concurrent = Concurrent::NO);
+    size_t width() const override { return fWidth; }
+    size_t height() const override { return fHeight; }
+    size_t bandHeight() const override { return fTileHeight; }
+    /// Renders tiles of a band in thread pool if concurrent
+    void produceRows(size_t y0, size_t nRows, char* dest, ptrdiff_t strideBytes) override;
+private:
+    size_t fWidth, fHeight, fTileWidth, fTileHeight;
+    RenderTile fRenderTile;
+    Concurrent fConcurrent;
+};
+
+/// Pulls the whole source into memory, for encoders that need it so
+Image toImage(RowSource& src);
@@ -0,0 +1,150 @@
+#include "scale.h"
+
+#include <algorithm>
+
+#include "parallel.h"
+#include "premultiply.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define SCALE_X86 1
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #define SCALE_NEON 1
+    #include <arm_neon.h>
+#endif
+
+
+unsigned nMipLevels(Dims dims, unsigned maxLevels)
+{
+    unsigned r = 0;
+    while (r < maxLevels) {
+        auto next = mipDims(dims, r + 1);
+        if (next.width == 0 || next.height == 0)
+            break;
+        ++r;
+    }
+    return r;
+}
+
+void downscaleRow2xScalar(Rgba* dest, const Rgba* a, const Rgba* b, size_t w)
+{
+    auto avg = [](unsigned p, unsigned q, unsigned r, unsigned s)
+        { return static_cast<unsigned char>((p + q + r + s + 2) >> 2); };
+    for (size_t x = 0; x < w / 2; ++x) {
+        auto p = a[2 * x], q = a[2 * x + 1], r = b[2 * x], s = b[2 * x + 1];
+        dest[x] = Rgba { .b = avg(p.b, q.b, r.b, s.b), .g = avg(p.g, q.g, r.g, s.g),
+                         .r = avg(p.r, q.r, r.r, s.r), .a = avg(p.a, q.a, r.a, s.a) };
+    }
+}
+
+#if SCALE_X86
+
+void downscaleRow2x(Rgba* dest, const Rgba* a, const Rgba* b, size_t w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    size_t x = 0;
+    // 4 source pixels of each row → 2 pixels
+    for (; x + 4 <= w; x += 4) {
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        // Pixels 0, 1 and 2, 3 of both rows summed in 16-bit lanes
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(pa, zero), _mm_unpacklo_epi8(pb, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(pa, zero), _mm_unpackhi_epi8(pb, zero));
+        // Neighbours in a row are halves of 64 bits
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_unpacklo_epi64(lo, hi);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x / 2), _mm_packus_epi16(sum, sum));
+    }
+    downscaleRow2xScalar(dest + x / 2, a + x, b + x, w - x);
+}
+
+#elif SCALE_NEON
+
+void downscaleRow2x(Rgba* dest, const Rgba* a, const Rgba* b, size_t w)
+{
+    size_t x = 0;
+    for (; x + 4 <= w; x += 4) {
+        uint8x16_t pa = vld1q_u8(reinterpret_cast<const uint8_t*>(a + x));
+        uint8x16_t pb = vld1q_u8(reinterpret_cast<const uint8_t*>(b + x));
+        uint16x8_t lo = vaddl_u8(vget_low_u8(pa), vget_low_u8(pb));
+        uint16x8_t hi = vaddl_u8(vget_high_u8(pa), vget_high_u8(pb));
+        uint16x8_t sum = vcombine_u16(vadd_u16(vget_low_u16(lo), vget_high_u16(lo)),
+                                      vadd_u16(vget_low_u16(hi), vget_high_u16(hi)));
+        // Rounding narrowing shift is (sum + 2) >> 2
+        vst1_u8(reinterpret_cast<uint8_t*>(dest + x / 2), vrshrn_n_u16(sum, 2));
+    }
+    downscaleRow2xScalar(dest + x / 2, a + x, b + x, w - x);
+}
+
+#else
+
+void downscaleRow2x(Rgba* dest, const Rgba* a, const Rgba* b, size_t w)
+{
+    downscaleRow2xScalar(dest, a, b, w);
+}
+
+#endif
+
+char* writeImageDataWithMips(char* p, const Image& im, Orient orient, Alpha alpha,
+                             std::span<char* const> mips)
+{
+    if (mips.empty())
+        return writeImageData(p, im, orient, alpha);
+    const Dims dims(im);
+    const unsigned nLevels = mips.size();
+    auto rowPtr = [&](char* level, unsigned iLevel, size_t y) {
+        auto levelDims = mipDims(dims, iLevel);
+        size_t dibY = (orient == Orient::TOP_DOWN) ? y : levelDims.height - 1 - y;
+        return reinterpret_cast<Rgba*>(level + dibY * levelDims.width * sizeof(Rgba));
+    };
+
+    // Blocks of 2^nLevels rows make whole rows of every level, so threads
+    // can take blocks independently
+    const size_t blockRows = size_t(1) << nLevels;
+    auto writeBlocks = [&](size_t b0, size_t b1) {
+        // Premultiplied pair of image rows, unless DIB has them so
+        std::vector<Rgba, NoInitAllocator<Rgba>> scratch(
+                (alpha == Alpha::PREMULTIPLIED) ? 0 : 2 * dims.width);
+        size_t y1 = std::min(b1 * blockRows, dims.height);
+        for (size_t y = b0 * blockRows; y < y1; ++y) {
+            auto src = im.uncheckedScanLine(y);
+            auto dest = rowPtr(p, 0, y);
+            const Rgba* premul;
+            if (alpha == Alpha::PREMULTIPLIED) {
+                premultiplyCopy(dest, src.data(), dims.width);
+                premul = dest;
+            } else {
+                memcpy(dest, src.data(), spanBytes(src));
+                auto row = scratch.data() + (y & 1) * dims.width;
+                premultiplyCopy(row, src.data(), dims.width);
+                premul = row;
+            }
+            if (!(y & 1))
+                continue;
+            // Odd row completes a row of level 1, and maybe more
+            const Rgba* prev = (alpha == Alpha::PREMULTIPLIED)
+                    ? rowPtr(p, 0, y - 1) : scratch.data();
+            const Rgba* cur = premul;
+            size_t levelY = y >> 1;
+            for (unsigned iLevel = 1; iLevel <= nLevels; ++iLevel) {
+                auto out = rowPtr(mips[iLevel - 1], iLevel, levelY);
+                downscaleRow2x(out, prev, cur, mipDims(dims, iLevel - 1).width);
+                if (!(levelY & 1) || iLevel == nLevels)
+                    break;
+                prev = rowPtr(mips[iLevel - 1], iLevel, levelY - 1);
+                cur = out;
+                levelY >>= 1;
+            }
+        }
+    };
+    size_t nBlocks = (dims.height + blockRows - 1) / blockRows;
+    if (im.nBytes() >= PARALLEL_ENCODE_BYTES) {
+        parallelFor(nBlocks, std::max<size_t>(1, PARALLEL_MIN_ROWS / blockRows), writeBlocks);
+    } else {
+        writeBlocks(0, nBlocks);
+    }
+    return p + im.nBytes();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <span>
+
+#include "dib.h"
+
+///
+///  2×2 box downscaling into mip levels: every level halves the previous
+///  one, dropping odd last column and row. Pixels should be premultiplied,
+///  or semi-transparent edges get wrong colours.
+///  All kernels give bit-exact results of downscaleRow2xScalar.
+///
+
+/// Size of level (0 = image itself)
+inline Dims mipDims(Dims dims, unsigned level)
+    { return Dims(dims.width >> level, dims.height >> level); }
+
+/// @return  levels, up to maxLevels, that are at least 1×1
+unsigned nMipLevels(Dims dims, unsigned maxLevels);
+
+/// 2×2 averages of rows a and b, w pixels each, to w/2 pixels of dest
+void downscaleRow2xScalar(Rgba* dest, const Rgba* a, const Rgba* b, size_t w);
+
+/// Same, with the best kernel for this CPU
+void downscaleRow2x(Rgba* dest, const Rgba* a, const Rgba* b, size_t w);
+
+/// Writes pixels of im like writeImageData, and in the same pass its
+/// levels 1…mips.size(), premultiplied, in the same row order to mips[i].
+/// Every level is made from rows of the previous one while those are in
+/// cache, so im is read only once.
+/// @return  pointer past pixels of im
+char* writeImageDataWithMips(char* p, const Image& im, Orient orient, Alpha alpha,
+                             std::span<char* const> mips);
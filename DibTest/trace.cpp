@@ -0,0 +1,70 @@
+#include "trace.h"
+
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <thread>
+
+static std::atomic<TraceSink*> currentSink = nullptr;
+
+void setTraceSink(TraceSink* sink)
+{
+    currentSink.store(sink, std::memory_order_release);
+}
+
+TraceSink* traceSink()
+{
+    return currentSink.load(std::memory_order_acquire);
+}
+
+using Us = std::chrono::duration<double, std::micro>;
+
+static size_t currentThreadId()
+{
+    return std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xFFFFFF;
+}
+
+ChromeTraceSink::ChromeTraceSink() : fOrigin(Clock::now()) {}
+
+void ChromeTraceSink::scope(const char* name, Clock::time_point start, Clock::duration duration)
+{
+    Event ev { .name = name, .ts = Us(start - fOrigin).count(), .dur = Us(duration).count(),
+               .value = -1, .threadId = currentThreadId() };
+    std::lock_guard lk(fMutex);
+    fEvents.push_back(ev);
+}
+
+void ChromeTraceSink::count(const char* name, uint64_t value)
+{
+    Event ev { .name = name, .ts = Us(Clock::now() - fOrigin).count(), .dur = 0,
+               .value = static_cast<int64_t>(value), .threadId = currentThreadId() };
+    std::lock_guard lk(fMutex);
+    fEvents.push_back(ev);
+}
+
+void ChromeTraceSink::writeJson(std::ostream& os) const
+{
+    std::lock_guard lk(fMutex);
+    os << "{\"traceEvents\":[";
+    bool isFirst = true;
+    for (auto& ev : fEvents) {
+        if (!isFirst)
+            os << ',';
+        isFirst = false;
+        // Names are our literals, nothing to escape
+        os << "\n{\"name\":\"" << ev.name << "\",\"pid\":1,\"tid\":" << ev.threadId
+           << ",\"ts\":" << ev.ts;
+        if (ev.value < 0) {
+            os << ",\"ph\":\"X\",\"dur\":" << ev.dur << '}';
+        } else {
+            os << ",\"ph\":\"C\",\"args\":{\"value\":" << ev.value << "}}";
+        }
+    }
+    os << "\n]}\n";
+}
+
+void ChromeTraceSink::clear()
+{
+    std::lock_guard lk(fMutex);
+    fEvents.clear();
+}
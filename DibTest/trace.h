@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <vector>
+
+///
+///  Tracing of hot paths: scoped timers and counters, sent to a pluggable
+///  sink. Macros compile to nothing unless CLIPBOARD_TRACE is defined;
+///  names should be string literals, sinks keep just pointers.
+///
+///  TRACE_SCOPE("name");          times the rest of the block
+///  TRACE_COUNT("name", value);   e.g. bytes moved
+///
+
+class TraceSink
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~TraceSink() = default;
+    /// Called from the thread that ran the scope, any thread
+    virtual void scope(const char* name, Clock::time_point start, Clock::duration duration) = 0;
+    virtual void count(const char* name, uint64_t value) = 0;
+};
+
+/// Sink is not owned and should outlive tracing; nullptr stops tracing
+void setTraceSink(TraceSink* sink);
+TraceSink* traceSink();
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : fSink(traceSink()), fName(name),
+          fStart(fSink ? TraceSink::Clock::now() : TraceSink::Clock::time_point{}) {}
+    ~TraceScope()
+        { if (fSink) fSink->scope(fName, fStart, TraceSink::Clock::now() - fStart); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator = (const TraceScope&) = delete;
+private:
+    TraceSink* fSink;
+    const char* fName;
+    TraceSink::Clock::time_point fStart;
+};
+
+inline void traceCount(const char* name, uint64_t value)
+{
+    if (auto sink = traceSink())
+        sink->count(name, value);
+}
+
+#ifdef CLIPBOARD_TRACE
+    #define TRACE_CONCAT2(x, y) x##y
+    #define TRACE_CONCAT(x, y) TRACE_CONCAT2(x, y)
+    #define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+    #define TRACE_COUNT(name, value) traceCount(name, value)
+#else
+    #define TRACE_SCOPE(name) ((void)0)
+    #define TRACE_COUNT(name, value) ((void)0)
+#endif
+
+///
+///  Collects events in memory and writes Chrome trace JSON, for
+///  chrome://tracing or Perfetto
+///
+class ChromeTraceSink : public TraceSink
+{
+public:
+    ChromeTraceSink();
+    void scope(const char* name, Clock::time_point start, Clock::duration duration) override;
+    void count(const char* name, uint64_t value) override;
+    void writeJson(std::ostream& os) const;
+    void clear();
+private:
+    struct Event {
+        const char* name;
+        /// Microseconds since sink creation
+        double ts, dur;
+        /// Negative for scopes
+        int64_t value;
+        size_t threadId;
+    };
+    Clock::time_point fOrigin;
+    mutable std::mutex fMutex;
+    std::vector<Event> fEvents;
+};